@@ -38,6 +38,11 @@ CK2Province::CK2Province (Object* o)
   }
 }
 
+void CK2Province::clear () {
+  Enumerable<CK2Province>::clear();
+  baronyMap.clear();
+}
+
 void CK2Province::assignProvince (EU4Province* t) {
   targets.push_back(t);
   t->assignProvince(this);
@@ -47,32 +52,36 @@ double CK2Province::getWeight (ProvinceWeight const* const pw) const {
   return weights[*pw];
 }
 
-void CK2Province::calculateWeights (Object* minWeights, objvec& buildings) {
+void CK2Province::calculateWeights (Object* minWeights,
+                                    const vector<BuildingWeights>& buildings) {
   for (unsigned int i = 0; i < weights.size(); ++i) weights[i] = 0;
   int baronies = 0;
   for (objiter barony = startBarony(); barony != finalBarony(); ++barony) {
     string baronyType = (*barony)->safeGetString("type", "None");
     if (baronyType == "None") continue;
     ++baronies;
-    std::unordered_set<Object*> province_buildings;
-    std::map<std::string, double> areaWeights;
+    // Which buildings the barony has does not depend on the weight.
+    vector<const BuildingWeights*> present;
+    for (const auto& building : buildings) {
+      if ((baronyType == building.key) ||
+          ((*barony)->safeGetString(building.key, "no") == "yes")) {
+        present.push_back(&building);
+      }
+    }
+    std::unordered_set<const BuildingWeights*> province_buildings;
     for (auto p = ProvinceWeight::start(); p != ProvinceWeight::final(); ++p) {
-      std::string areaName = (*p)->getName();
+      int index = **p;
+      double areaWeight = 0;
       double multiplier = 0;
-      for (auto* building : buildings) {
-        string key = building->getKey();
-        if (((*barony)->safeGetString(key, "no") != "yes") &&
-            (baronyType != key)) {
-          continue;
-        }
-        double weight = building->safeGetFloat(areaName);
-        areaWeights[areaName] += weight;
-        multiplier += building->safeGetFloat(areaName + "_mult");
+      for (const auto* building : present) {
+        double weight = building->weights[index];
+        areaWeight += weight;
+        multiplier += building->mults[index];
         if (weight + multiplier > 0) {
           province_buildings.insert(building);
         }
       }
-      (*barony)->setLeaf(areaName, areaWeights[areaName] * (1 + multiplier));
+      (*barony)->setLeaf((*p)->getName(), areaWeight * (1 + multiplier));
     }
     Logger::logStream("buildings") << (*barony)->getKey() << " in "
                                    << nameAndNumber(this) << " has weights:\n"
@@ -89,12 +98,12 @@ void CK2Province::calculateWeights (Object* minWeights, objvec& buildings) {
       }
       Logger::logStream("buildings") << LogOption::Indent << "from: ";
       for (const auto* building : province_buildings) {
-        double weight = building->safeGetFloat(areaName);
-        double mult = building->safeGetFloat(areaName + "_mult");
+        double weight = building->weights[**p];
+        double mult = building->mults[**p];
         if (weight + mult < 0.00001) {
           continue;
         }
-        Logger::logStream("buildings") << "(" << building->getKey();
+        Logger::logStream("buildings") << "(" << building->key;
         if (weight > 0) {
           Logger::logStream("buildings") << " " << weight;
         }
@@ -19,13 +19,25 @@ public:
   static ProvinceWeight const* const Fortification;
 };
 
+// What a building type adds to each ProvinceWeight, indexed by number. The
+// table is built once per conversion, so the barony loops compare no keys
+// in the building objects.
+struct BuildingWeights {
+  Object* building;
+  string key;
+  vector<double> weights;
+  vector<double> mults;
+};
+
 class CK2Province : public Enumerable<CK2Province>, public ObjectWrapper {
 public:
   CK2Province (Object* o);
+  static void clear ();
 
   void addBarony (Object* house) {baronies.push_back(house);}
   void assignProvince (EU4Province* t);
-  void calculateWeights (Object* weightObject, objvec& buildings);
+  void calculateWeights (Object* weightObject,
+                         const vector<BuildingWeights>& buildings);
   CK2Title* getCountyTitle () const {return countyTitle;}
   double getWeight (ProvinceWeight const* const pw) const;
   int numEU4Provinces () const {return targets.size();}
@@ -10,6 +10,8 @@
 
 objvec CK2Character::ckTraits;
 objvec CK2Character::euRulerTraits;
+unordered_set<Object*> CK2Character::wrappedObjects;
+CharacterGraph CK2Character::relations;
 
 CKAttribute const* const CKAttribute::Diplomacy    = new CKAttribute("diplomacy",   false);
 CKAttribute const* const CKAttribute::Martial      = new CKAttribute("martial",     false);
@@ -23,8 +25,56 @@ CouncilTitle const* const CouncilTitle::Steward    = new CouncilTitle("job_treas
 CouncilTitle const* const CouncilTitle::Spymaster  = new CouncilTitle("job_spymaster",  false);
 CouncilTitle const* const CouncilTitle::Chaplain   = new CouncilTitle("job_spiritual",  true);
 
+CharacterRelation const* const CharacterRelation::Parent   = new CharacterRelation("parent",   false);
+CharacterRelation const* const CharacterRelation::Spouse   = new CharacterRelation("spouse",   false);
+CharacterRelation const* const CharacterRelation::Employer = new CharacterRelation("employer", true);
+
 bool CK2Ruler::humansSovereign = false;
 
+void CharacterGraph::addEdge (int source, int target, CharacterRelation const* const relation) {
+  if (source <= 0 || target <= 0) return;
+  Edge edge = {target, relation};
+  pending.push_back(make_pair(source, edge));
+}
+
+// Counting sort of the pending edges by source, keeping insertion order
+// within each source.
+void CharacterGraph::build () {
+  int maxId = 0;
+  for (const auto& p : pending) {
+    if (p.first > maxId) maxId = p.first;
+  }
+  offsets.assign(maxId + 2, 0);
+  for (const auto& p : pending) {
+    offsets[p.first + 1]++;
+  }
+  for (int i = 1; i < (int) offsets.size(); ++i) {
+    offsets[i] += offsets[i - 1];
+  }
+  edges.resize(pending.size());
+  vector<int> fill(offsets.begin(), offsets.end() - 1);
+  for (const auto& p : pending) {
+    edges[fill[p.first]++] = p.second;
+  }
+  vector<pair<int, Edge> >().swap(pending);
+}
+
+void CharacterGraph::clear () {
+  pending.clear();
+  offsets.clear();
+  edges.clear();
+}
+
+CharacterGraph::EdgeIter CharacterGraph::startEdge (int source) const {
+  if (source < 0 || source + 1 >= (int) offsets.size()) return edges.end();
+  return edges.begin() + offsets[source];
+}
+
+CharacterGraph::EdgeIter CharacterGraph::finalEdge (int source) const {
+  if (source < 0 || source + 1 >= (int) offsets.size()) return edges.end();
+  return edges.begin() + offsets[source + 1];
+}
+
 CK2Character::CK2Character (Object* obj, Object* dynasties)
   : ObjectWrapper(obj)
   , admiral(0)
@@ -34,6 +84,7 @@ CK2Character::CK2Character (Object* obj, Object* dynasties)
   , heir(0)
   , heir_override(false)
 {
+  wrappedObjects.insert(obj);
   string dynastyNum = safeGetString(dynastyString, PlainNone);
   if (dynastyNum != PlainNone) {
     dynasty = dynasties->safeGetObject(dynastyNum);
@@ -195,6 +246,12 @@ CK2Ruler::CK2Ruler (Object* obj, Object* dynasties)
   , totalRealmBaronies(-1)
 {}
 
+void CK2Ruler::clear () {
+  Enumerable<CK2Ruler>::clear();
+  wrappedObjects.clear();
+  relations.clear();
+}
+
 void CK2Ruler::addTitle (CK2Title* title) {
   titles.push_back(title);
   titlesWithVassals.push_back(title);
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <string>
 
@@ -33,6 +34,40 @@ public:
   static CouncilTitle const* const Chaplain;
 };
 
+class CharacterRelation : public Enumerable<const CharacterRelation> {
+public:
+  CharacterRelation (string n, bool f) : Enumerable<const CharacterRelation>(this, n, f) {}
+
+  static CharacterRelation const* const Parent;
+  static CharacterRelation const* const Spouse;
+  static CharacterRelation const* const Employer;
+};
+
+// Typed relations between living characters, as a compressed sparse-row
+// graph indexed by character id. An edge from A to B means B's record names
+// A as parent, spouse or employer.
+// Edges of one source are contiguous and in the order they were added.
+class CharacterGraph {
+public:
+  struct Edge {
+    int target;
+    CharacterRelation const* relation;
+  };
+  typedef vector<Edge>::const_iterator EdgeIter;
+
+  void addEdge (int source, int target, CharacterRelation const* const relation);
+  void build ();
+  void clear ();
+  EdgeIter startEdge (int source) const;
+  EdgeIter finalEdge (int source) const;
+  int numEdges () const {return edges.size();}
+
+private:
+  vector<pair<int, Edge> > pending;
+  vector<int> offsets;
+  vector<Edge> edges;
+};
+
 class CK2Character : public ObjectWrapper {
 public:
   CK2Character (Object* obj, Object* dynasties);
@@ -53,6 +88,7 @@ public:
   CK2Character* getHeir () const {return heir;}
   bool hasModifier (const string& mod);
   bool hasTrait (const string& t) const {return 0 != traits.count(t);}
+  static bool isWrapped (Object* obj) {return 0 != wrappedObjects.count(obj);}
 
   CharacterIter startChild () const {return children.begin();}
   CharacterIter finalChild () const {return children.end();}
@@ -66,8 +102,12 @@ public:
 
   static objvec ckTraits;
   static objvec euRulerTraits;
+  static CharacterGraph relations;
 
 protected:
+  // Character objects that have a wrapper; anything else may be pruned.
+  static unordered_set<Object*> wrappedObjects;
+
   CK2Character* admiral;
   vector<int> attributes;
   vector<CK2Character*> children;
@@ -85,6 +125,8 @@ protected:
 class CK2Ruler : public Enumerable<CK2Ruler>, public CK2Character {
 public:
   CK2Ruler (Object* obj, Object* dynasties);
+  // Also forgets the character wrappers and relation graph.
+  static void clear ();
 
   void addEnemy (CK2Ruler* enemy) {enemies.push_back(enemy);}
   void addTitle (CK2Title* title);
@@ -103,7 +145,7 @@ public:
   bool isRebel ();
   bool isSovereign () const {return (0 == liege || (humansSovereign && isHuman()));}
   void personOfInterest (CK2Character* person);
-  void setEU4Country (EU4Country* eu4) {eu4Country = eu4;}
+  void setEU4Country (EU4Country* eu4) {eu4Country = eu4; CK2Title::invalidateSovereigns();}
 
   Container& getVassals() { return vassals; }
   CK2Title::Container& getTitles() { return titles; }
@@ -1,5 +1,8 @@
 #include "CK2Title.hh"
 
+#include <map>
+#include <utility>
+
 #include "CK2Ruler.hh"
 #include "EU4Country.hh"
 #include "Logger.hh"
@@ -15,6 +18,8 @@ CK2Title::Container CK2Title::kingdoms;
 CK2Title::Container CK2Title::duchies;
 CK2Title::Container CK2Title::counties;
 CK2Title::Container CK2Title::baronies;
+bool CK2Title::flattened = false;
+int CK2Title::generation = 0;
 
 TitleLevel const* const TitleLevel::getLevel (const string& key) {
   switch (key[0]) {
@@ -42,6 +47,11 @@ CK2Title::CK2Title (Object* o)
   , liegeTitle(0)
   , titleLevel(TitleLevel::getLevel(o->getKey()))
   , isRebel(false)
+  , deJureEntry(-1)
+  , deJureExit(-1)
+  , sovereignTitle(0)
+  , sovereignDistance(0)
+  , cacheGeneration(-1)
 {
   if (TitleLevel::Empire  == getLevel()) empires.push_back(this);
   else if (TitleLevel::Kingdom == getLevel()) kingdoms.push_back(this);
@@ -50,7 +60,23 @@ CK2Title::CK2Title (Object* o)
   else baronies.push_back(this);
 }
 
+void CK2Title::clear () {
+  Enumerable<CK2Title>::clear();
+  empires.clear();
+  kingdoms.clear();
+  duchies.clear();
+  counties.clear();
+  baronies.clear();
+  flattened = false;
+  invalidateSovereigns();
+}
+
 int CK2Title::distanceToSovereign () {
+  if (cacheGeneration != generation) getSovereignTitle();
+  return sovereignDistance;
+}
+
+int CK2Title::findDistanceToSovereign () {
   CK2Ruler* sovereign = getSovereign();
   if (!sovereign) return 0;
   CK2Ruler* ruler = getRuler();
@@ -78,6 +104,7 @@ void CK2Title::addClaimant (CK2Character* claimant) {
 }
 
 CK2Title* CK2Title::getDeJureLevel (TitleLevel const* const level) {
+  if (flattened) return deJureAncestors[*level];
   CK2Title* curr = this;
   while (curr) {
     if (curr->getLevel() == level) return curr;
@@ -133,6 +160,16 @@ CK2Ruler* CK2Title::getSovereign () {
 }
 
 CK2Title* CK2Title::getSovereignTitle () {
+  if (cacheGeneration == generation) return sovereignTitle;
+  sovereignTitle = findSovereignTitle();
+  // Mark the title as cached first, since the distance calculation asks for
+  // the sovereign again.
+  cacheGeneration = generation;
+  sovereignDistance = findDistanceToSovereign();
+  return sovereignTitle;
+}
+
+CK2Title* CK2Title::findSovereignTitle () {
   CK2Title* currTitle = this;
   // Straightforward liege chain.
   while (currTitle) {
@@ -169,6 +206,9 @@ CK2Title* CK2Title::getSovereignTitle () {
 }
 
 bool CK2Title::isDeJureOverlordOf (CK2Title* dat) const {
+  if (flattened && dat && deJureEntry >= 0 && dat->deJureEntry >= 0) {
+    return deJureEntry <= dat->deJureEntry && dat->deJureExit <= deJureExit;
+  }
   while (dat) {
     if (this == dat) return true;
     dat = dat->getDeJureLiege();
@@ -180,6 +220,68 @@ void CK2Title::setDeJureLiege (CK2Title* djl) {
   if (!djl) return;
   Logger::logStream("titles") << getName() << " has de jure liege " << djl->getName() << "\n";
   deJureLiege = djl;
+  flattened = false;
+}
+
+void CK2Title::flattenHierarchies () {
+  // Resolve the lazily-found de facto lieges once, up front.
+  for (auto* title : getAll()) {
+    title->getLiege();
+  }
+
+  map<CK2Title*, vector<CK2Title*> > deJureVassals;
+  for (auto* title : getAll()) {
+    title->deJureEntry = -1;
+    title->deJureExit = -1;
+    title->deJureAncestors.assign(TitleLevel::totalAmount(), 0);
+    if (title->getDeJureLiege()) {
+      deJureVassals[title->getDeJureLiege()].push_back(title);
+    }
+  }
+
+  // Iterative Euler tour from each de jure root. Titles in a de jure cycle
+  // are never reached; they keep entry -1 and their queries walk the chain.
+  int clock = 0;
+  vector<pair<CK2Title*, unsigned int> > stack;
+  for (auto* root : getAll()) {
+    if (root->getDeJureLiege()) continue;
+    root->deJureAncestors[*root->getLevel()] = root;
+    root->deJureEntry = clock++;
+    stack.push_back(make_pair(root, 0u));
+    while (!stack.empty()) {
+      CK2Title* curr = stack.back().first;
+      unsigned int next = stack.back().second++;
+      vector<CK2Title*>& vassals = deJureVassals[curr];
+      if (next >= vassals.size()) {
+        curr->deJureExit = clock++;
+        stack.pop_back();
+        continue;
+      }
+      CK2Title* vassal = vassals[next];
+      vassal->deJureAncestors = curr->deJureAncestors;
+      vassal->deJureAncestors[*vassal->getLevel()] = vassal;
+      vassal->deJureEntry = clock++;
+      stack.push_back(make_pair(vassal, 0u));
+    }
+  }
+
+  // Anything unreached gets its table filled by walking, so getDeJureLevel
+  // never needs the fallback.
+  for (auto* title : getAll()) {
+    if (title->deJureEntry >= 0) continue;
+    for (auto* level : TitleLevel::getAll()) {
+      CK2Title* curr = title;
+      int steps = 0;
+      while (curr && curr->getLevel() != level &&
+             steps++ < (int) totalAmount()) {
+        curr = curr->getDeJureLiege();
+      }
+      title->deJureAncestors[*level] = (curr && curr->getLevel() == level) ? curr : 0;
+    }
+  }
+
+  flattened = true;
+  invalidateSovereigns();
 }
 
 CK2Title::Iter CK2Title::startLevel (TitleLevel const* const level) {
@@ -22,6 +22,7 @@ public:
 class CK2Title : public Enumerable<CK2Title>, public ObjectWrapper {
 public:
   CK2Title (Object* o);
+  static void clear ();
 
   void addClaimant (CK2Character* claimant);
   int distanceToSovereign ();
@@ -36,9 +37,9 @@ public:
   string getTag() { return getKey(); }
   bool isDeJureOverlordOf (CK2Title* dat) const;
   bool isRebelTitle () const {return isRebel;}
-  void setRuler (CK2Ruler* r) {ruler = r;}
+  void setRuler (CK2Ruler* r) {ruler = r; invalidateSovereigns();}
   void setDeJureLiege (CK2Title* djl);
-  void setEU4Country (EU4Country* eu4) {eu4country = eu4;}
+  void setEU4Country (EU4Country* eu4) {eu4country = eu4; invalidateSovereigns();}
   vector<CK2Character*>::iterator startClaimant () {return claimants.begin();}
   vector<CK2Character*>::iterator finalClaimant () {return claimants.end();}
 
@@ -46,7 +47,18 @@ public:
   static Iter finalEmpire () {return empires.end();}
   static Iter startLevel (TitleLevel const* const level);
   static Iter finalLevel (TitleLevel const* const level);
+
+  // Precomputes the de jure ancestor tables and resolves all lieges, so that
+  // the hierarchy queries above do not walk chains. Call once all titles and
+  // de jure lieges exist.
+  static void flattenHierarchies ();
+  // Sovereigns depend on which titles and rulers have EU4 nations; anything
+  // that changes those must call this.
+  static void invalidateSovereigns () {++generation;}
 private:
+  CK2Title* findSovereignTitle ();
+  int findDistanceToSovereign ();
+
   vector<CK2Character*> claimants;
   EU4Country* eu4country;
   CK2Ruler* ruler;
@@ -55,6 +67,20 @@ private:
   TitleLevel const* const titleLevel;
   bool isRebel;
 
+  // Flattened de jure hierarchy: nearest ancestor-or-self per title level,
+  // and entry and exit times of an Euler tour over the de jure forest.
+  vector<CK2Title*> deJureAncestors;
+  int deJureEntry;
+  int deJureExit;
+
+  // Cached de facto queries, valid while cacheGeneration == generation.
+  CK2Title* sovereignTitle;
+  int sovereignDistance;
+  int cacheGeneration;
+
+  static bool flattened;
+  static int generation;
+
   static Container empires;
   static Container kingdoms;
   static Container duchies;
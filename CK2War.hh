@@ -10,6 +10,7 @@
 class CK2War : public Enumerable<CK2War>, public ObjectWrapper {
 public:
   CK2War (Object* obj);
+  static void clear () {Enumerable<CK2War>::clear();}
 
   enum WarMask {
     Attackers = 1,
@@ -1,11 +1,18 @@
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
 #include <cstdio>
 #include <direct.h>
 #include <deque>
 #include <exception>
 #include <iostream> 
+#include <mutex>
+#include <queue>
 #include <string>
 #include <set>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -44,7 +51,11 @@ ConverterJob const *const ConverterJob::PlayerWars =
 ConverterJob const *const ConverterJob::Statistics = 
     new ConverterJob("statistics", false);
 ConverterJob const *const ConverterJob::DynastyScores = 
-    new ConverterJob("dynasty_scores", true);
+    new ConverterJob("dynasty_scores", false);
+ConverterJob const *const ConverterJob::DiffSaves =
+    new ConverterJob("diff_saves", false);
+ConverterJob const *const ConverterJob::MemoryCensus =
+    new ConverterJob("memory_census", true);
 
 namespace {
 unordered_set<EU4Country*> independenceRevolts;
@@ -57,21 +68,249 @@ const string kStateKey = "part_of_state";
 map<string, unordered_set<EU4Province*>> area_province_map;
 std::string gameDate = "";
 int gameDays = 0;
+
+// Read from maps_dir by loadFiles, besides input.eu4 and the custom file.
+const vector<string> kMapsFiles = {
+    "provinces.txt", "de_jure_lieges.txt", "ck_buildings.txt",
+    "ck_building_weights.txt", "eu_buildings.txt", "ck_traits.txt",
+    "eu_ruler_traits.txt", "eu_leader_traits.txt", "advisors.txt",
+    "areas.txt", "ck_province_titles.txt", "dynasties.txt"};
+
+ParseOptions ck2SaveOptions () {
+  ParseOptions options;
+  options.ignoreString = "CK2txt";
+  options.specialCases["de_jure_liege=}"] = "";
+  options.specialCases["\t="] = "special_f=";
+  options.specialCases["\\\""] = "'";
+  return options;
+}
+
+ParseOptions eu4SaveOptions () {
+  ParseOptions options;
+  options.ignoreString = "EU4txt";
+  options.specialCases["map_area_data{"] = "map_area_data={";
+  return options;
+}
+// Hands out EU4 ids. The counters are read from eu4Game once, drawn from
+// atomically, and written back once before output, so stages that create
+// units and characters can do so from several threads.
+class IdAllocator {
+public:
+  IdAllocator () : loaded(false) {}
+
+  void load (Object* game);
+  void flush (Object* game);
+  bool isLoaded () const {return loaded;}
+  int next (const string& keyword) {return reserve(keyword, 1);}
+  // Returns the first of 'count' consecutive ids.
+  int reserve (const string& keyword, int count);
+
+private:
+  static const int kNumKeywords = 5;
+  static const char* const kKeywords[kNumKeywords];
+  // Position in id_counters, or -1 for a top-level leaf.
+  static const int kCounterIndex[kNumKeywords];
+
+  bool loaded;
+  std::atomic<int> values[kNumKeywords];
+};
+
+const char* const IdAllocator::kKeywords[IdAllocator::kNumKeywords] = {
+    "monarch", "leader", "advisor", "rebel", "unit"};
+const int IdAllocator::kCounterIndex[IdAllocator::kNumKeywords] = {1, 2, 3, 4,
+                                                                   -1};
+
+void IdAllocator::load (Object* game) {
+  Object* counters = game->safeGetObject("id_counters");
+  for (int i = 0; i < kNumKeywords; ++i) {
+    if (counters != nullptr && kCounterIndex[i] >= 0) {
+      values[i] = counters->tokenAsInt(kCounterIndex[i]);
+    } else {
+      values[i] = game->safeGetInt(kKeywords[i], 1);
+    }
+  }
+  loaded = true;
+}
+
+void IdAllocator::flush (Object* game) {
+  if (!loaded) return;
+  Object* counters = game->safeGetObject("id_counters");
+  for (int i = 0; i < kNumKeywords; ++i) {
+    if (counters != nullptr && kCounterIndex[i] >= 0) {
+      counters->resetToken(kCounterIndex[i], std::to_string(values[i].load()));
+    } else {
+      game->resetLeaf(kKeywords[i], values[i].load());
+    }
+  }
+}
+
+int IdAllocator::reserve (const string& keyword, int count) {
+  for (int i = 0; i < kNumKeywords; ++i) {
+    if (keyword == kKeywords[i]) return values[i].fetch_add(count);
+  }
+  throwFormatted("Unknown id keyword %s", keyword.c_str());
+  return -1;
+}
+
+IdAllocator idAllocator;
+
+// Characters of dynasties with custom scores, collected in the single pass
+// over the character section in createCK2Objects.
+unordered_map<string, Object*> scoredCharacters;
+
+// One exported table of statistics; every cell is already formatted.
+struct StatsTable {
+  StatsTable (const string& n, const vector<string>& c) : name(n), columns(c) {}
+  void addRow (const vector<string>& row) {rows.push_back(row);}
+
+  string name;
+  vector<string> columns;
+  vector<vector<string> > rows;
+};
+
+template <class T> string statsCell (const T& value) {
+  ostringstream cell;
+  cell << value;
+  return cell.str();
+}
+
+string csvCell (const string& cell) {
+  if (cell.find_first_of(",\"\n") == string::npos) return cell;
+  string ret = "\"";
+  for (char c : cell) {
+    if (c == '"') ret += '"';
+    ret += c;
+  }
+  return ret + "\"";
+}
+
+// True if cell is a number as JSON spells it: no leading zeros, plus
+// signs, hex, infinities or bare decimal points.
+bool isJsonNumber (const string& cell) {
+  unsigned int pos = 0;
+  auto digits = [&cell, &pos] () {
+    unsigned int start = pos;
+    while (pos < cell.size() && isdigit(cell[pos])) ++pos;
+    return pos - start;
+  };
+  if (pos < cell.size() && cell[pos] == '-') ++pos;
+  if (pos < cell.size() && cell[pos] == '0') {
+    ++pos;
+  } else if (digits() == 0) {
+    return false;
+  }
+  if (pos < cell.size() && cell[pos] == '.') {
+    ++pos;
+    if (digits() == 0) return false;
+  }
+  if (pos < cell.size() && (cell[pos] == 'e' || cell[pos] == 'E')) {
+    ++pos;
+    if (pos < cell.size() && (cell[pos] == '+' || cell[pos] == '-')) ++pos;
+    if (digits() == 0) return false;
+  }
+  return pos == cell.size();
+}
+
+string jsonCell (const string& cell) {
+  if (isJsonNumber(cell)) return cell;
+  string ret = "\"";
+  for (char c : cell) {
+    if ((unsigned char) c < 0x20) {
+      ret += createString("\\u%04x", (int) c);
+      continue;
+    }
+    if (c == '"' || c == '\\') ret += '\\';
+    ret += c;
+  }
+  return ret + "\"";
+}
+
+// Writes one Output\<prefix>_<name>.csv per table, or all tables to
+// Output\<jsonName>.json as {"table": [{"column": value, ...}, ...]}.
+void exportStats (const vector<StatsTable>& tables, const string& format,
+                  const string& prefix = "stats",
+                  const string& jsonName = "statistics") {
+  if (format == "csv") {
+    for (const auto& table : tables) {
+      string fname = ".\\Output\\" + prefix + "_" + table.name + ".csv";
+      ofstream writer(fname.c_str());
+      for (unsigned int i = 0; i < table.columns.size(); ++i) {
+        writer << (i > 0 ? "," : "") << csvCell(table.columns[i]);
+      }
+      writer << "\n";
+      for (const auto& row : table.rows) {
+        for (unsigned int i = 0; i < row.size(); ++i) {
+          writer << (i > 0 ? "," : "") << csvCell(row[i]);
+        }
+        writer << "\n";
+      }
+      Logger::logStream(LogStream::Info) << "Wrote " << fname << "\n";
+    }
+    return;
+  }
+  if (format != "json") {
+    Logger::logStream(LogStream::Warn)
+        << "Unknown statistics export format " << format << ", not exporting.\n";
+    return;
+  }
+  string fname = ".\\Output\\" + jsonName + ".json";
+  ofstream writer(fname.c_str());
+  writer << "{";
+  for (unsigned int t = 0; t < tables.size(); ++t) {
+    const StatsTable& table = tables[t];
+    writer << (t > 0 ? ",\n" : "\n") << "  " << jsonCell(table.name) << ": [";
+    for (unsigned int r = 0; r < table.rows.size(); ++r) {
+      writer << (r > 0 ? ",\n" : "\n") << "    {";
+      for (unsigned int i = 0; i < table.columns.size(); ++i) {
+        writer << (i > 0 ? ", " : "") << jsonCell(table.columns[i]) << ": "
+               << jsonCell(table.rows[r][i]);
+      }
+      writer << "}";
+    }
+    writer << "\n  ]";
+  }
+  writer << "\n}\n";
+  Logger::logStream(LogStream::Info) << "Wrote " << fname << "\n";
+}
 }
 
+// Shared between a converter and its prefetch thread. The thread is
+// detached, so if the converter goes first, the thread deletes what it
+// parsed itself.
+struct PrefetchState {
+  PrefetchState () : finished(false), abandoned(false) {}
+  bool isAbandoned () {
+    std::lock_guard<std::mutex> lock(mutex);
+    return abandoned;
+  }
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool finished;
+  bool abandoned;
+  map<string, Object*> parsed;
+};
+
 Converter::Converter (Window* ow, string fn)
   : ck2FileName(fn)
   , ck2Game(0)
   , eu4Game(0)
+  , cancelRequested(false)
+  , jobCancelled(false)
+  , ck2Modified(false)
+  , ck2LoadedHash(0)
+  , checkpointRecord(0)
   , ckBuildingObject(0)
   , ckBuildingWeights(0)
   , configObject(0)
+  , configLoaded(0)
   , countryMapObject(0)
   , customObject(0)
   , deJureObject(0)
   , euBuildingObject(0)
   , provinceMapObject(0)
   , outputWindow(ow)
+  , stageItemsDone(0)
 {
   configure(); 
 }  
@@ -79,6 +318,19 @@ Converter::Converter (Window* ow, string fn)
 Converter::~Converter () {
   if (eu4Game) delete eu4Game;
   if (ck2Game) delete ck2Game; 
+  if (checkpointRecord) delete checkpointRecord;
+  if (configLoaded) delete configLoaded;
+  if (prefetch) {
+    // Never wait for the prefetch here; the window deletes converters on
+    // its own thread. The prefetch thread cleans up after itself instead.
+    std::lock_guard<std::mutex> lock(prefetch->mutex);
+    if (prefetch->finished) {
+      for (auto& file : prefetch->parsed) delete file.second;
+      prefetch->parsed.clear();
+    }
+    prefetch->abandoned = true;
+  }
+  for (auto& file : prefetchedFiles) delete file.second;
   eu4Game = 0;
   ck2Game = 0; 
 }
@@ -93,6 +345,8 @@ void Converter::run () {
 
     ConverterJob const* const job = jobsToDo.front();
     jobsToDo.pop();
+    cancelRequested = false;
+    jobCancelled = false;
     try {
       if (ConverterJob::Convert        == job) convert();
       if (ConverterJob::DebugParser    == job) debugParser();
@@ -103,6 +357,13 @@ void Converter::run () {
       if (ConverterJob::PlayerWars     == job) playerWars();
       if (ConverterJob::Statistics     == job) statistics();
       if (ConverterJob::DynastyScores  == job) dynastyScores();
+      if (ConverterJob::DiffSaves      == job) diffSaves();
+      if (ConverterJob::MemoryCensus   == job) memoryCensus();
+      if (AllocationProfile::active()) reportAllocations();
+      // Only a job that stopped on the request leaves half-built state; a
+      // request arriving after its last check is too late and is dropped.
+      if (jobCancelled) resetAfterCancel();
+      cancelRequested = false;
     } catch(const std::bad_alloc& e) {
       delete emergency;
       Logger::logStream(LogStream::Error)
@@ -126,43 +387,91 @@ void Converter::run () {
 
 void Converter::loadFile () {
   if (ck2FileName == "") return;
-  Parser::ignoreString = "CK2txt";
-  Parser::specialCases["de_jure_liege=}"] = "";
-  Parser::specialCases["\t="] = "special_f=";
-  Parser::specialCases["\\\""] = "'";
-  ck2Game = loadTextFile(ck2FileName);
-  Parser::ignoreString = "";
-  Parser::specialCases.clear();
+  prefetchFiles();
+  loadCK2Game();
   Logger::logStream(LogStream::Info) << "Ready to convert.\n";
 }
 
+void Converter::loadCK2Game () {
+  ck2Game = loadTextFile(ck2FileName, ck2SaveOptions());
+  ck2Modified = false;
+  if (configObject->safeGetString("verify_reset", "no") != "yes") return;
+  TreeHashes hashes;
+  hashes.compute(ck2Game);
+  ck2LoadedHash = hashes.get(ck2Game);
+}
+
+// Drops every wrapper and the state built alongside them, leaving the
+// parsed files untouched.
+void Converter::clearWrappers () {
+  CK2War::clear();
+  CK2Ruler::clear();
+  CK2Title::clear();
+  CK2Province::clear();
+  EU4Country::clear();
+  EU4Province::clear();
+  scoredCharacters.clear();
+  independenceRevolts.clear();
+  area_province_map.clear();
+  religionMap.clear();
+  cultureMap.clear();
+}
+
+// Pruning deletes parts of the CK save that a conversion no longer needs,
+// and the conversion stages leave markers and running totals in it, such
+// as madeCharacters and used_for_eu_provs. Clearing those one by one would
+// miss the next one added, so the save is parsed again instead. The
+// wrappers point into the old save, so they go too. Config entries the
+// stages wrote are put back at the same time.
+void Converter::restoreLoadedState () {
+  restoreConfig();
+  if (!ck2Modified) return;
+  Logger::logStream(LogStream::Info)
+      << "Save was changed by an earlier job, reloading it.\n";
+  clearWrappers();
+  delete ck2Game;
+  loadCK2Game();
+}
+
+// Cancelled jobs stop between stages, or inside the longer loops, leaving
+// the wrappers half-built. Throw them all away so the next job starts as if
+// the save had just been loaded.
+void Converter::resetAfterCancel () {
+  Logger::logStream(LogStream::Info) << "Job cancelled, resetting.\n";
+  finishProgress(false);
+  clearWrappers();
+  if (eu4Game) delete eu4Game;
+  eu4Game = 0;
+  restoreLoadedState();
+  if (configObject->safeGetString("verify_reset", "no") == "yes") {
+    verifyReset();
+  }
+}
+
 void Converter::cleanUp () {
   // Restore the initial '-' in province tags.
   string minus("-");
   for (auto* eu4prov : EU4Province::getAll()) {
     eu4prov->object->setKey(minus + eu4prov->getKey());
-    eu4prov->unsetValue(kStateKey);
     if (eu4prov->converts()) {
-      eu4prov->unsetValue("fort_level");
-      eu4prov->unsetValue("base_fort_level");
-      eu4prov->unsetValue("influencing_fort");
-      eu4prov->unsetValue("fort_influencing");
-      eu4prov->unsetValue("estate");
+      unsetValues(eu4prov->object, {kStateKey, "fort_level", "base_fort_level",
+                                    "influencing_fort", "fort_influencing",
+                                    "estate"});
       auto* history = eu4prov->safeGetObject("history");
       if (history) {
         history->unsetValue("seat_in_parliament");
       }
+    } else {
+      eu4prov->unsetValue(kStateKey);
     }
   }
 
   string infantryType = configObject->safeGetString("infantry_type", "\"western_medieval_infantry\"");
   string cavalryType = configObject->safeGetString("cavalry_type", "\"western_medieval_knights\"");
   for (auto* eu4country : EU4Country::getAll()) {
-    eu4country->unsetValue("needs_heir");
-    eu4country->unsetValue(EU4Country::kNoProvinceMarker);
     double fraction = eu4country->safeGetFloat("manpower_fraction");
-    eu4country->unsetValue("manpower_fraction");
-    eu4country->unsetValue("ck_troops");
+    unsetValues(eu4country->object, {"needs_heir", EU4Country::kNoProvinceMarker,
+                                     "manpower_fraction", "ck_troops"});
     if (!eu4country->getRuler()) continue;
     Object* unitTypes = eu4country->getNeededObject("sub_unit");
     unitTypes->resetLeaf("infantry", infantryType);
@@ -215,8 +524,160 @@ void Converter::cleanUp () {
   eu4Game->unsetValue("previous_war");
 }
 
+ConverterProgress Converter::getProgress () const {
+  QMutexLocker locker(&progressMutex);
+  ConverterProgress ret = progress;
+  ret.itemsDone = stageItemsDone;
+  if (ret.running) estimate(ret);
+  return ret;
+}
+
+namespace {
+const string kStageTimesFile = ".\\Output\\stage_times.txt";
+}
+
+void Converter::startProgress (const string& job, const vector<string>& stages) {
+  QMutexLocker locker(&progressMutex);
+  progressStages = stages;
+  restoredStages.clear();
+  stageSeconds.clear();
+  stageWeights.clear();
+  ifstream reader(kStageTimesFile.c_str());
+  if (reader.good()) {
+    reader.close();
+    Object* times = parseFile(kStageTimesFile);
+    Object* jobTimes = times ? times->safeGetObject(job) : nullptr;
+    if (jobTimes) {
+      for (auto* stage : jobTimes->getLeaves()) {
+        stageWeights[stage->getKey()] = stage->getLeafAsFloat();
+      }
+    }
+    delete times;
+  }
+  progress = ConverterProgress();
+  progress.job = job;
+  progress.numStages = stages.size();
+  progress.running = true;
+  jobTimer.start();
+  stageTimer.start();
+}
+
+void Converter::beginStage (const string& stage, bool restored) {
+  QMutexLocker locker(&progressMutex);
+  if (!progress.stage.empty()) {
+    stageSeconds[progress.stage] = stageTimer.elapsed() * 0.001;
+    progress.stageIndex++;
+  }
+  stageTimer.start();
+  AllocationProfile::beginStage(stage);
+  if (restored) restoredStages.insert(stage);
+  progress.stage = stage;
+  stageItemsDone = 0;
+  progress.itemsTotal = 0;
+  estimate(progress);
+
+  ofstream* debug = Logger::getLogFile();
+  if (debug) {
+    (*debug) << stage << " (" << progress.stageIndex + 1 << "/"
+             << progress.numStages << ")";
+    if (progress.secondsLeft >= 0) {
+      (*debug) << ", about " << (int) progress.secondsLeft << "s left";
+    }
+    (*debug) << std::endl;
+  }
+}
+
+void Converter::setStageItems (int total) {
+  QMutexLocker locker(&progressMutex);
+  stageItemsDone = 0;
+  progress.itemsTotal = total;
+}
+
+void Converter::advanceStage (int items) {
+  stageItemsDone.fetch_add(items, std::memory_order_relaxed);
+}
+
+void Converter::finishProgress (bool success) {
+  QMutexLocker locker(&progressMutex);
+  if (!progress.stage.empty()) {
+    stageSeconds[progress.stage] = stageTimer.elapsed() * 0.001;
+  }
+  progress.running = false;
+  progress.secondsLeft = 0;
+  if (!success) return;
+  progress.fractionDone = 1;
+
+  // Keep the timings of other jobs.
+  Object* times = nullptr;
+  ifstream reader(kStageTimesFile.c_str());
+  if (reader.good()) {
+    reader.close();
+    times = parseFile(kStageTimesFile);
+  }
+  if (!times) times = new Object("stage_times");
+  times->unsetValue(progress.job);
+  Object* jobTimes = new Object(progress.job);
+  for (const auto& stage : progressStages) {
+    if (!restoredStages.count(stage)) {
+      jobTimes->setLeaf(stage, stageSeconds[stage]);
+      continue;
+    }
+    // Restored from a checkpoint rather than run; keep the earlier timing.
+    auto earlier = stageWeights.find(stage);
+    if (earlier != stageWeights.end()) jobTimes->setLeaf(stage, earlier->second);
+  }
+  times->setValue(jobTimes);
+  ofstream writer(kStageTimesFile.c_str());
+  ParseOptions options;
+  options.topLevel = times;
+  writeObject(writer, times, options);
+  delete times;
+}
+
+// Assumes the mutex is held. Stages without earlier timings count as the
+// average known stage, or as equal shares if nothing is known; stages
+// restored from a checkpoint count for nothing. Done on demand, so that
+// advanceStage stays cheap enough for per-item loops.
+void Converter::estimate (ConverterProgress& prog) const {
+  double known = 0;
+  int numKnown = 0;
+  for (const auto& stage : progressStages) {
+    auto weight = stageWeights.find(stage);
+    if (weight != stageWeights.end()) {
+      known += weight->second;
+      ++numKnown;
+    }
+  }
+  double defaultWeight = (numKnown > 0 && known > 0) ? known / numKnown : 1;
+  double total = 0;
+  double done = 0;
+  for (int i = 0; i < (int) progressStages.size(); ++i) {
+    if (restoredStages.count(progressStages[i])) continue;
+    auto found = stageWeights.find(progressStages[i]);
+    double weight = (found != stageWeights.end()) ? found->second : defaultWeight;
+    total += weight;
+    if (i < prog.stageIndex) {
+      done += weight;
+    } else if (i == prog.stageIndex && prog.itemsTotal > 0) {
+      done += weight * min(prog.itemsDone, prog.itemsTotal) / prog.itemsTotal;
+    }
+  }
+  if (total <= 0) return;
+  prog.fractionDone = done / total;
+  double elapsed = jobTimer.elapsed() * 0.001;
+  if (done > 0 && elapsed > 0) {
+    prog.secondsLeft = elapsed * (total - done) / done;
+  } else if (numKnown > 0) {
+    prog.secondsLeft = total - done;
+  } else {
+    prog.secondsLeft = -1;
+  }
+}
+
 void Converter::configure () {
-  configObject = processFile("config.txt");
+  configObject = parseFile("config.txt");
+  if (configLoaded) delete configLoaded;
+  configLoaded = new Object(configObject);
   Logger::logStream(LogStream::Debug).setActive(false);
 
   Object* debug = configObject->safeGetObject("streams");
@@ -250,6 +711,7 @@ void Converter::dejures () {
   Logger::logStream(LogStream::Info)
       << "Outputting de-jure lieges from savegame.\n";
   configure();
+  restoreLoadedState();
   if (!createCK2Objects()) return;
 
   for (CK2Title::Iter title = CK2Title::start(); title != CK2Title::final(); ++title) {
@@ -277,18 +739,264 @@ void Converter::dejures () {
 }
 
 void Converter::debugParser () {
+  restoreLoadedState();
   objvec parsed = ck2Game->getLeaves();
   Logger::logStream(LogStream::Info) << "Last parsed object:\n"
                                      << parsed.back();
 }
 
+namespace {
+struct CensusEntry {
+  CensusEntry() : nodes(0), stringBytes(0), overhead(0) {}
+  void add(const CensusEntry& other) {
+    nodes += other.nodes;
+    stringBytes += other.stringBytes;
+    overhead += other.overhead;
+  }
+  size_t total() const { return stringBytes + overhead; }
+
+  size_t nodes;
+  size_t stringBytes;
+  // Object structs, parent-vector slots, token strings and heap blocks.
+  size_t overhead;
+};
+
+// Strings longer than this get their own heap block.
+const size_t kInlineStringSize = string().capacity();
+// Rough guess at allocator bookkeeping per heap block.
+const size_t kHeapBlockOverhead = 16;
+
+void countString(const string& str, CensusEntry* entry) {
+  entry->stringBytes += str.size();
+  if (str.size() > kInlineStringSize) {
+    entry->overhead += kHeapBlockOverhead;
+  }
+}
+
+// True for keys like 12345 or -12, used for characters, provinces and the like.
+bool isIdKey(const string& key) {
+  if (key.empty()) return false;
+  if (key[0] == '-') return key.size() > 1 && isdigit(key[1]);
+  return isdigit(key[0]) != 0;
+}
+
+void countNode(Object* node, CensusEntry* entry) {
+  entry->nodes++;
+  entry->overhead += sizeof(Object) + sizeof(Object*) + kHeapBlockOverhead;
+  countString(node->getKey(), entry);
+  if (node->isLeaf()) {
+    countString(node->getLeaf(), entry);
+    return;
+  }
+  for (int i = 0; i < node->numTokens(); ++i) {
+    entry->overhead += sizeof(string);
+    countString(node->getToken(i), entry);
+  }
+  objvec leaves = node->getLeaves();
+  for (auto* leaf : leaves) {
+    countNode(leaf, entry);
+  }
+}
+
+void logCensus(const string& title, const map<string, CensusEntry>& census,
+               int maxLines) {
+  vector<pair<string, CensusEntry>> sorted(census.begin(), census.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const pair<string, CensusEntry>& one,
+               const pair<string, CensusEntry>& two) {
+              return one.second.total() > two.second.total();
+            });
+  Logger::logStream(LogStream::Info) << title << ":\n" << LogOption::Indent;
+  int lines = 0;
+  for (const auto& entry : sorted) {
+    if (lines++ >= maxLines) {
+      break;
+    }
+    Logger::logStream(LogStream::Info)
+        << entry.first << " : " << (int)entry.second.nodes << " nodes, "
+        << (int)(entry.second.stringBytes / 1024) << " kB strings, "
+        << (int)(entry.second.overhead / 1024) << " kB overhead\n";
+  }
+  Logger::logStream(LogStream::Info) << LogOption::Undent;
+}
+
+// Counts the memory held by the tree under root, by top-level section and by
+// section/key pairs such as character/b_d.
+void takeCensus(Object* root, const string& name, int maxLines) {
+  if (!root) {
+    Logger::logStream(LogStream::Info) << "No " << name << " loaded.\n";
+    return;
+  }
+  map<string, CensusEntry> sections;
+  map<string, CensusEntry> keys;
+  CensusEntry total;
+  objvec leaves = root->getLeaves();
+  for (auto* section : leaves) {
+    CensusEntry& sectionEntry = sections[section->getKey()];
+    if (section->isLeaf()) {
+      countNode(section, &sectionEntry);
+      total.add(sectionEntry);
+      continue;
+    }
+    // Count the section node itself without its children; those are
+    // attributed to their keys below.
+    sectionEntry.nodes++;
+    sectionEntry.overhead += sizeof(Object) + sizeof(Object*);
+    countString(section->getKey(), &sectionEntry);
+    objvec children = section->getLeaves();
+    for (auto* child : children) {
+      // Keyed lists such as characters have one child per id; look one level
+      // further down so the key names a field rather than an id.
+      objvec fields;
+      if (!child->isLeaf() && isIdKey(child->getKey())) {
+        fields = child->getLeaves();
+        CensusEntry holder;
+        holder.nodes++;
+        holder.overhead += sizeof(Object) + sizeof(Object*);
+        countString(child->getKey(), &holder);
+        sectionEntry.add(holder);
+        keys[section->getKey() + "/<id>"].add(holder);
+      } else {
+        fields.push_back(child);
+      }
+      for (auto* field : fields) {
+        CensusEntry fieldEntry;
+        countNode(field, &fieldEntry);
+        keys[section->getKey() + "/" + field->getKey()].add(fieldEntry);
+        sectionEntry.add(fieldEntry);
+      }
+    }
+    total.add(sectionEntry);
+  }
+
+  Logger::logStream(LogStream::Info)
+      << name << " : " << (int)total.nodes << " nodes, "
+      << (int)(total.stringBytes / 1024) << " kB strings, "
+      << (int)(total.overhead / 1024) << " kB estimated overhead\n"
+      << LogOption::Indent;
+  logCensus("Sections", sections, maxLines);
+  logCensus("Keys", keys, maxLines);
+  Logger::logStream(LogStream::Info) << LogOption::Undent;
+}
+}  // namespace
+
+void Converter::memoryCensus () {
+  if (!ck2Game) {
+    Logger::logStream(LogStream::Info) << "No file loaded.\n";
+    return;
+  }
+  restoreLoadedState();
+  if (!eu4Game) {
+    loadFiles();
+  }
+
+  int maxLines = configObject->safeGetInt("census_lines", 25);
+  Logger::logStream(LogStream::Info) << "Memory census.\n" << LogOption::Indent;
+  takeCensus(ck2Game, "CK2 save", maxLines);
+  takeCensus(eu4Game, "EU4 input", maxLines);
+  Logger::logStream(LogStream::Info) << LogOption::Undent
+                                     << "Done with memory census.\n";
+}
+
+void Converter::diffSaves () {
+  Object* diffConfig = configObject->getNeededObject("diff_saves");
+  string firstName = remQuotes(
+      diffConfig->safeGetString("first", "\".\\Output\\converted.eu4\""));
+  string secondName = remQuotes(diffConfig->safeGetString("second", QuotedNone));
+  unsigned int maxChanges = diffConfig->safeGetInt("max_changes", 100);
+  Logger::logStream(LogStream::Info)
+      << "Comparing " << firstName << " with " << secondName << ".\n"
+      << LogOption::Indent;
+  Object* first = loadTextFile(firstName, eu4SaveOptions());
+  Object* second = loadTextFile(secondName, eu4SaveOptions());
+  if (!first || !second) {
+    Logger::logStream(LogStream::Error)
+        << "Could not load both files, cannot compare.\n" << LogOption::Undent;
+    delete first;
+    delete second;
+    return;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  TreeHashes firstHashes;
+  TreeHashes secondHashes;
+  firstHashes.compute(first);
+  secondHashes.compute(second);
+  int hashTime = (int) timer.restart();
+  vector<string> changes;
+  diffTrees(first, second, firstHashes, secondHashes, changes, maxChanges);
+  for (const auto& change : changes) {
+    Logger::logStream(LogStream::Info) << change << "\n";
+  }
+  if (changes.empty()) {
+    Logger::logStream(LogStream::Info) << "No differences.\n";
+  } else if (changes.size() >= maxChanges) {
+    Logger::logStream(LogStream::Info)
+        << "Stopped after " << maxChanges << " changes.\n";
+  }
+  Logger::logStream(LogStream::Info)
+      << "Hashing took " << hashTime << " ms, comparing "
+      << (int) timer.elapsed() << " ms.\n" << LogOption::Undent;
+  delete first;
+  delete second;
+}
+
+void Converter::reportAllocations () {
+  AllocationProfile::stop();
+  Object* profileConfig = configObject->getNeededObject("allocation_profile");
+  unsigned int maxSites = profileConfig->safeGetInt("sites", 5);
+  Logger::logStream(LogStream::Info) << "Allocations by stage:\n" << LogOption::Indent;
+  for (const auto& stage : AllocationProfile::results()) {
+    Logger::logStream(LogStream::Info)
+        << stage.name << ": "
+        << createString("%lld allocations, %.1f MB, %lld since freed",
+                        stage.allocations, stage.bytes / 1048576.0,
+                        stage.frees);
+    if (stage.untracked > 0) {
+      // The block table was full; these frees were not seen.
+      Logger::logStream(LogStream::Info)
+          << createString(", %lld more not followed", stage.untracked);
+    }
+    Logger::logStream(LogStream::Info) << ".\n" << LogOption::Indent;
+    for (unsigned int i = 0; i < stage.sites.size() && i < maxSites; ++i) {
+      const auto& site = stage.sites[i];
+      Logger::logStream(LogStream::Info)
+          << site.name << ": "
+          << createString("%lld allocations, %.1f MB.\n", site.allocations,
+                          site.bytes / 1048576.0);
+    }
+    Logger::logStream(LogStream::Info) << LogOption::Undent;
+  }
+  Logger::logStream(LogStream::Info) << LogOption::Undent;
+}
+
 struct TitleStats {
+  TitleStats () : title(0), totalWeight(0), averageTech(0) {}
   CK2Title* title;
   std::vector<CK2Province*> ck2Provinces;
+  double totalWeight;
+  double averageTech;
+  void summarise();
   void print() const;
 };
 
-std::unordered_map<CK2Title*, TitleStats> statsMap;
+// Sorts the provinces best-first and fills in the totals. Touches nothing
+// but this object, so titles can be summarised in parallel.
+void TitleStats::summarise() {
+  std::sort(ck2Provinces.begin(), ck2Provinces.end(),
+            [](const CK2Province* one, const CK2Province* two) {
+              // Descending order, greater-than.
+              return one->totalWeight() > two->totalWeight();
+            });
+  totalWeight = 0;
+  averageTech = 0;
+  for (const auto* p : ck2Provinces) {
+    totalWeight += p->totalWeight();
+    averageTech += p->totalTech();
+  }
+  if (!ck2Provinces.empty()) averageTech /= ck2Provinces.size();
+}
 
 void TitleStats::print() const {
   if (ck2Provinces.empty()) {
@@ -301,11 +1009,6 @@ void TitleStats::print() const {
   if (ck2Provinces.size() > 20) numToPrint++;
   if (numToPrint > ck2Provinces.size())
     numToPrint = ck2Provinces.size();
-  double avg_tech = 0;
-  for (const auto* p : ck2Provinces) {
-    avg_tech += p->totalTech();
-  }
-  avg_tech /= ck2Provinces.size();
 
   Logger::logStream(LogStream::Info) << title->getKey() << ":\n"
                                      << LogOption::Indent;
@@ -326,7 +1029,7 @@ void TitleStats::print() const {
   }
   Logger::logStream(LogStream::Info) << LogOption::Undent;
 
-  Logger::logStream(LogStream::Info) << "Average tech: " << avg_tech << "\n";
+  Logger::logStream(LogStream::Info) << "Average tech: " << averageTech << "\n";
   Logger::logStream(LogStream::Info) << LogOption::Undent;
 }
 
@@ -373,65 +1076,107 @@ bool Converter::displayStats() {
   if (statConfig->safeGetString("show", "no") != "yes") {
     return true;
   }
+  string exportFormat = statConfig->safeGetString("export", "no");
+  bool exporting = (exportFormat != "no");
+  vector<StatsTable> tables;
   Logger::logStream(LogStream::Info) << "Statistics:\n" << LogOption::Indent;
-  for (auto prov = CK2Province::start(); prov != CK2Province::final(); ++prov) {
-    auto* title = (*prov)->getCountyTitle();
-    if (!title) continue;
-    while ((title = title->getDeJureLiege()) != 0) {
-      if (title->getLevel() != TitleLevel::Kingdom &&
-          title->getLevel() != TitleLevel::Empire) {
-        continue;
-      }
-      if (statsMap.find(title) == statsMap.end()) {
-        statsMap[title].title = title;
-      }
-      statsMap[title].ck2Provinces.push_back(*prov);
+
+  // The sovereign caches fill in lazily; fill them here so that the
+  // parallel passes below only read.
+  for (auto* title : CK2Title::getAll()) {
+    title->getSovereignTitle();
+  }
+
+  typedef std::unordered_map<CK2Title*, std::vector<CK2Province*>> TitleProvinces;
+  const auto& ck2Provinces = CK2Province::getAll();
+  auto titlePartials = parallelPartials<TitleProvinces>(
+      ck2Provinces.size(), [&](TitleProvinces& partial, int idx) {
+        auto* county = ck2Provinces[idx]->getCountyTitle();
+        if (!county) return;
+        for (auto* level : {TitleLevel::Kingdom, TitleLevel::Empire}) {
+          CK2Title* title = county->getDeJureLevel(level);
+          if (title) partial[title].push_back(ck2Provinces[idx]);
+        }
+      });
+  std::unordered_map<CK2Title*, TitleStats> statsMap;
+  for (auto& partial : titlePartials) {
+    for (auto& tp : partial) {
+      TitleStats& stat = statsMap[tp.first];
+      stat.title = tp.first;
+      stat.ck2Provinces.insert(stat.ck2Provinces.end(), tp.second.begin(),
+                               tp.second.end());
     }
   }
-
+  std::vector<TitleStats*> allStats;
   for (auto& ts : statsMap) {
-    auto& stat = ts.second;
-    std::sort(stat.ck2Provinces.begin(), stat.ck2Provinces.end(),
-              [](const CK2Province* one, const CK2Province* two) {
-                // Descending order, greater-than.
-                return one->totalWeight() > two->totalWeight();
-              });
-  }
-
-  for (auto emp = CK2Title::startEmpire(); emp != CK2Title::finalEmpire();
-       ++emp) {
-    statsMap[*emp].print();
-  }
-  for (auto kng = CK2Title::startLevel(TitleLevel::Kingdom);
-       kng != CK2Title::finalLevel(TitleLevel::Kingdom); ++kng) {
-    statsMap[*kng].print();
-  }
-
-  std::unordered_map<EU4Country*, std::unordered_set<std::string>>
-      country_states;
+    allStats.push_back(&ts.second);
+  }
+  parallelFor(allStats.size(), [&](int idx) {allStats[idx]->summarise();});
+
+  StatsTable titleTable("titles", {"title", "level", "ck2_provinces",
+                                   "total_weight", "average_tech"});
+  StatsTable weightTable("title_provinces", {"title", "ck2_province", "name",
+                                             "weight", "eu4_province", "eu4_dev"});
+  std::vector<CK2Title*> printOrder(CK2Title::startEmpire(), CK2Title::finalEmpire());
+  printOrder.insert(printOrder.end(), CK2Title::startLevel(TitleLevel::Kingdom),
+                    CK2Title::finalLevel(TitleLevel::Kingdom));
+  for (auto* title : printOrder) {
+    auto stat = statsMap.find(title);
+    if (stat == statsMap.end()) continue;
+    stat->second.print();
+    if (!exporting) continue;
+    titleTable.addRow({title->getKey(), title->getLevel()->getName(),
+                       statsCell(stat->second.ck2Provinces.size()),
+                       statsCell(stat->second.totalWeight),
+                       statsCell(stat->second.averageTech)});
+    for (auto* prov : stat->second.ck2Provinces) {
+      EU4Province* conv = prov->numEU4Provinces() > 0 ? prov->eu4Province(0) : nullptr;
+      weightTable.addRow({title->getKey(), prov->getKey(),
+                          remQuotes(prov->safeGetString("name")),
+                          statsCell(prov->totalWeight()),
+                          conv ? conv->getKey() : "",
+                          conv ? statsCell(conv->totalDev()) : ""});
+    }
+  }
+  tables.push_back(titleTable);
+  tables.push_back(weightTable);
+
+  typedef std::unordered_map<EU4Country*, std::set<std::string>> CountryStates;
+  std::vector<const std::string*> stateNames;
   for (auto& state : area_province_map) {
-    const std::string& state_name = state.first;
-    for (auto* eu4prov : state.second) {
-      EU4Country* eu4Country = eu4prov->getEU4Country();
-      if (!eu4Country) {
+    stateNames.push_back(&state.first);
+  }
+  auto statePartials = parallelPartials<CountryStates>(
+      stateNames.size(), [&](CountryStates& partial, int idx) {
+        for (auto* eu4prov : area_province_map.at(*stateNames[idx])) {
+          EU4Country* eu4Country = eu4prov->getEU4Country();
+          if (!eu4Country) {
+            continue;
+          }
+          partial[eu4Country].insert(*stateNames[idx]);
+        }
+      });
+  std::map<std::string, std::set<std::string>> country_states;
+  for (auto& partial : statePartials) {
+    for (auto& cs : partial) {
+      if (!cs.first->getRuler() || !cs.first->getRuler()->isHuman()) {
         continue;
       }
-      country_states[eu4Country].insert(state_name);
+      country_states[cs.first->getKey()].insert(cs.second.begin(), cs.second.end());
     }
   }
 
+  StatsTable stateTable("states", {"country", "state", "size"});
+  StatsTable stateSummary("state_sizes", {"country", "states", "average", "median"});
   Logger::logStream(LogStream::Info) << "State sizes:\n";
   for (auto& it : country_states) {
-    EU4Country* country = it.first;
-    if (!country->getRuler() || !country->getRuler()->isHuman()) {
-      continue;
-    }
-    Logger::logStream(LogStream::Info) << country->getKey() << " : ";
+    Logger::logStream(LogStream::Info) << it.first << " : ";
     std::vector<int> sizeCounts(100, 0);
     for (const auto& stateName : it.second) {
       int stateSize = area_province_map[stateName].size();
       sizeCounts[stateSize]++;
       Logger::logStream(LogStream::Info) << stateName << " (" << stateSize << ") ";
+      stateTable.addRow({it.first, stateName, statsCell(stateSize)});
     }
     Logger::logStream(LogStream::Info) << "\n";
     double average = 0;
@@ -439,69 +1184,163 @@ bool Converter::displayStats() {
     getAverageAndMedian(sizeCounts, average, median);
     Logger::logStream(LogStream::Info) << "Average : " << average << "\n";
     Logger::logStream(LogStream::Info) << "Median : " << median << "\n";
+    stateSummary.addRow({it.first, statsCell(it.second.size()),
+                         statsCell(average), statsCell(median)});
   }
+  tables.push_back(stateTable);
+  tables.push_back(stateSummary);
 
-  Logger::logStream(LogStream::Info) << "\nShared provinces:\n";
+  // Per EU4 province: the independent rulers it converts from, in the order
+  // met, and any warnings, which are logged after the parallel pass.
+  struct SharedProvince {
+    EU4Province* eu4prov;
+    std::vector<std::pair<CK2Ruler*, std::vector<CK2Province*>>> sovereigns;
+  };
+  struct SharedPartial {
+    std::vector<SharedProvince> shared;
+    std::vector<std::string> warnings;
+  };
   int requiredHumans = statConfig->safeGetInt("humans_for_overlap");
-  for (auto* eu4prov : EU4Province::getAll()) {
-    if (!eu4prov->converts()) {
-      continue;
-    }
-    std::unordered_map<CK2Ruler*, std::vector<CK2Province*>> sovereigns;
-    int numHumans = 0;
-    for (auto* ck2Prov : eu4prov->ckProvs()) {
-      auto* title = ck2Prov->getCountyTitle();
-      if (title == nullptr) {
-        Logger::logStream(LogStream::Warn)
-            << "CK2 province " << nameAndNumber(ck2Prov)
-            << " does not have an associated title?\n";
-        continue;
-      }
-      auto* ruler = title->getSovereign();
-      if (ruler == nullptr) {
-        Logger::logStream(LogStream::Warn)
-            << "CK2 province " << nameAndNumber(ck2Prov)
-            << " does not have a sovereign for its title " << title->getKey()
-            << "?\n";
-        continue;
-      }
-      
-      if (ruler->isHuman() && sovereigns.find(ruler) == sovereigns.end()) {
-        numHumans++;
-      }
-      sovereigns[ruler].push_back(ck2Prov);
-    }
-    if (sovereigns.size() < 2 || numHumans < requiredHumans) {
-      continue;
+  const auto& eu4Provinces = EU4Province::getAll();
+  auto sharedPartials = parallelPartials<SharedPartial>(
+      eu4Provinces.size(), [&](SharedPartial& partial, int idx) {
+        EU4Province* eu4prov = eu4Provinces[idx];
+        if (!eu4prov->converts()) {
+          return;
+        }
+        SharedProvince shared;
+        shared.eu4prov = eu4prov;
+        int numHumans = 0;
+        for (auto* ck2Prov : eu4prov->ckProvs()) {
+          auto* title = ck2Prov->getCountyTitle();
+          if (title == nullptr) {
+            partial.warnings.push_back("CK2 province " + nameAndNumber(ck2Prov) +
+                                       " does not have an associated title?\n");
+            continue;
+          }
+          auto* ruler = title->getSovereign();
+          if (ruler == nullptr) {
+            partial.warnings.push_back(
+                "CK2 province " + nameAndNumber(ck2Prov) +
+                " does not have a sovereign for its title " + title->getKey() +
+                "?\n");
+            continue;
+          }
+          auto existing = std::find_if(
+              shared.sovereigns.begin(), shared.sovereigns.end(),
+              [ruler](const std::pair<CK2Ruler*, std::vector<CK2Province*>>& s) {
+                return s.first == ruler;
+              });
+          if (existing == shared.sovereigns.end()) {
+            if (ruler->isHuman()) numHumans++;
+            shared.sovereigns.emplace_back(ruler, std::vector<CK2Province*>());
+            existing = shared.sovereigns.end() - 1;
+          }
+          existing->second.push_back(ck2Prov);
+        }
+        if (shared.sovereigns.size() < 2 || numHumans < requiredHumans) {
+          return;
+        }
+        partial.shared.push_back(shared);
+      });
+
+  StatsTable sharedTable("shared_provinces", {"eu4_province", "ruler", "title",
+                                              "eu4_country", "ck2_province"});
+  Logger::logStream(LogStream::Info) << "\nShared provinces:\n";
+  for (const auto& partial : sharedPartials) {
+    for (const auto& warning : partial.warnings) {
+      Logger::logStream(LogStream::Warn) << warning;
     }
-    Logger::logStream(LogStream::Info)
-        << "Province " << nameAndNumber(eu4prov)
-        << " converts from multiple independent rulers:\n"
-        << LogOption::Indent;
-    for (auto& sovereign : sovereigns) {
-      CK2Title* primary = sovereign.first->getPrimaryTitle();
+    for (const auto& shared : partial.shared) {
       Logger::logStream(LogStream::Info)
-          << nameAndNumber(sovereign.first, birthNameString) << " "
-          << nameAndNumber(primary, "name", "\"???\"") << " -> "
-          << primary->getEU4Country()->getKey() << " : ";
-      for (auto* prov : sovereign.second) {
-        Logger::logStream(LogStream::Info) << nameAndNumber(prov) << " ";
+          << "Province " << nameAndNumber(shared.eu4prov)
+          << " converts from multiple independent rulers:\n"
+          << LogOption::Indent;
+      for (auto& sovereign : shared.sovereigns) {
+        CK2Title* primary = sovereign.first->getPrimaryTitle();
+        string countryTag = primary->getEU4Country()->getKey();
+        Logger::logStream(LogStream::Info)
+            << nameAndNumber(sovereign.first, birthNameString) << " "
+            << nameAndNumber(primary, "name", "\"???\"") << " -> "
+            << countryTag << " : ";
+        for (auto* prov : sovereign.second) {
+          Logger::logStream(LogStream::Info) << nameAndNumber(prov) << " ";
+          sharedTable.addRow({shared.eu4prov->getKey(), sovereign.first->getKey(),
+                              primary->getKey(), countryTag, prov->getKey()});
+        }
+        Logger::logStream(LogStream::Info) << "\n";
       }
-      Logger::logStream(LogStream::Info) << "\n";
+      Logger::logStream(LogStream::Info) << LogOption::Undent;
     }
-    Logger::logStream(LogStream::Info) << LogOption::Undent;
   }
-  
+  tables.push_back(sharedTable);
+
+  if (exporting) {
+    exportStats(tables, exportFormat);
+  }
   Logger::logStream(LogStream::Info) << "Done with statistics.\n"
                                      << LogOption::Undent;
   return true;
 }
 
+void Converter::exportWorld () {
+  string format = configObject->safeGetString("world_export", "no");
+  if (format == "no") return;
+  Logger::logStream(LogStream::Info) << "Exporting world tables.\n" << LogOption::Indent;
+
+  StatsTable provinceTable("provinces", {"id", "name", "owner", "base_tax",
+                                         "base_production", "base_manpower",
+                                         "culture", "religion", "converted"});
+  StatsTable provinceMap("province_map", {"ck2_province", "eu4_province",
+                                          "ck2_weight"});
+  for (auto* eu4prov : EU4Province::getAll()) {
+    provinceTable.addRow({eu4prov->getKey(),
+                          remQuotes(eu4prov->safeGetString("name")),
+                          remQuotes(eu4prov->safeGetString("owner")),
+                          eu4prov->safeGetString("base_tax", "0"),
+                          eu4prov->safeGetString("base_production", "0"),
+                          eu4prov->safeGetString("base_manpower", "0"),
+                          remQuotes(eu4prov->safeGetString("culture")),
+                          remQuotes(eu4prov->safeGetString("religion")),
+                          eu4prov->converts() ? "yes" : "no"});
+    for (auto* ck2prov : eu4prov->ckProvs()) {
+      provinceMap.addRow({ck2prov->getKey(), eu4prov->getKey(),
+                          statsCell(ck2prov->totalWeight())});
+    }
+  }
+
+  StatsTable countryTable("countries", {"tag", "ck2_title", "ck2_ruler",
+                                        "human", "provinces", "development",
+                                        "capital", "culture", "religion"});
+  for (auto* eu4country : EU4Country::getAll()) {
+    if (!eu4country->converts()) continue;
+    CK2Title* title = eu4country->getTitle();
+    CK2Ruler* ruler = eu4country->getRuler();
+    double development = 0;
+    for (auto* eu4prov : eu4country->getProvinces()) {
+      development += eu4prov->totalDev();
+    }
+    countryTable.addRow(
+        {eu4country->getKey(), title ? title->getKey() : "",
+         ruler ? ruler->getKey() : "",
+         (ruler && ruler->isHuman()) ? "yes" : "no",
+         statsCell(eu4country->getProvinces().size()), statsCell(development),
+         eu4country->safeGetString("capital"),
+         remQuotes(eu4country->safeGetString("primary_culture")),
+         remQuotes(eu4country->safeGetString("religion"))});
+  }
+
+  exportStats({provinceTable, countryTable, provinceMap}, format, "world",
+              "world");
+  Logger::logStream(LogStream::Info) << LogOption::Undent;
+}
+
 void Converter::statistics() {
   if (!ck2Game) {
     Logger::logStream(LogStream::Info) << "No file loaded.\n";
     return; 
   }
+  restoreLoadedState();
 
   loadFiles();
   if (!createCK2Objects()) return;
@@ -515,6 +1354,7 @@ void Converter::statistics() {
 
 void Converter::playerWars () {
   Logger::logStream(LogStream::Info) << "Player wars.\n";
+  restoreLoadedState();
   if (!createCK2Objects()) {
     return;
   }
@@ -550,19 +1390,39 @@ void Converter::playerWars () {
 
 void Converter::dynastyScores () {
   Logger::logStream(LogStream::Info) << "Dynastic scores.\n";
+  restoreLoadedState();
   loadFiles();
   if (!customObject) {
     Logger::logStream(LogStream::Warn)
         << "Couldn't find custom object, no dynastic scores.\n";
     return;
   }
+  vector<string> stages = {"createCK2Objects", "calculateDynasticScores"};
+  startProgress("dynastyScores", stages);
+  beginStage("createCK2Objects");
   if (!createCK2Objects()) {
+    finishProgress(false);
     return;
   }
+  if (cancelled()) return;
+  beginStage("calculateDynasticScores");
   calculateDynasticScores();
+  finishProgress(true);
 }
 
-Object* Converter::loadTextFile (string fname) {
+Object* Converter::loadTextFile (string fname, const ParseOptions& options) {
+  if (prefetchNames.count(fname)) {
+    collectPrefetch();
+    prefetchNames.erase(fname);
+    auto found = prefetchedFiles.find(fname);
+    if (found != prefetchedFiles.end()) {
+      Logger::logStream(LogStream::Info) << "Using prefetched " << fname << "\n";
+      Object* ret = found->second;
+      prefetchedFiles.erase(found);
+      return ret;
+    }
+  }
+
   Logger::logStream(LogStream::Info) << "Parsing file " << fname << "\n";
   ifstream reader;
   reader.open(fname.c_str());
@@ -572,7 +1432,7 @@ Object* Converter::loadTextFile (string fname) {
   }
   reader.close();
   
-  Object* ret = processFile(fname);
+  Object* ret = parseFile(fname, options);
   Logger::logStream(LogStream::Info) << " ... done.\n";
   return ret; 
 }
@@ -611,6 +1471,7 @@ bool Converter::swapKeys (Object* one, Object* two, string key) {
 
 void Converter::checkProvinces () {
   Logger::logStream(LogStream::Info) << "Checking provinces.\n";
+  restoreLoadedState();
   if (!createCK2Objects()) {
     return;
   }
@@ -675,12 +1536,8 @@ void Converter::mergeSaves () {
   }
   string secondary_input =
       customObject->safeGetString("province_overrides", PlainNone);
-  Parser::ignoreString = "EU4txt";
-  Parser::specialCases["map_area_data{"] = "map_area_data={";
-  eu4Game = loadTextFile(dirToUse + "input.eu4");
-  Object* secondGame = loadTextFile(dirToUse + secondary_input);
-  Parser::specialCases.clear();
-  Parser::ignoreString = "";
+  eu4Game = loadTextFile(dirToUse + "input.eu4", eu4SaveOptions());
+  Object* secondGame = loadTextFile(dirToUse + secondary_input, eu4SaveOptions());
   Logger::logStream(LogStream::Info) << "Done loading input files\n"
                                      << LogOption::Undent;
 
@@ -757,39 +1614,447 @@ void Converter::mergeSaves () {
 }
 
 void Converter::writeConvertedSave (Object* final) {
-  Parser::EqualsSign = "="; // No whitespace around equals, thanks Paradox.
+  ParseOptions options;
+  options.equalsSign = "="; // No whitespace around equals, thanks Paradox.
+  options.topLevel = eu4Game;
   ofstream writer;
   writer.open(".\\Output\\converted.eu4");
-  Parser::topLevel = eu4Game;
   writer << "EU4txt\n";
-  writer << (*eu4Game);
+  writeObject(writer, eu4Game, options);
   // No closing endline, thanks Paradox.
   writer << final->getKey() << "=" << final->getLeaf();
   Logger::logStream(LogStream::Info) << "Done writing.\n";
 }
 
-void detectChangedString(const string& old_string, const string& new_string,
-                         const objvec& objects, string* target) {
-  *target = new_string;
-  for (auto* obj : objects) {
-    Object* newObject = obj->safeGetObject(new_string);
-    Object* oldObject = obj->safeGetObject(old_string);
-    if (!newObject && !oldObject)
+namespace {
+const string kCheckpointKey = "converter_checkpoint";
+
+string checkpointFile (const string& stage) {
+  return ".\\Output\\checkpoint_" + stage + ".eu4";
+}
+
+// Config entries a stage writes for later stages to read. Resuming skips
+// the stage, so the checkpoint carries them.
+const map<string, vector<string> > kStageConfigOutputs = {
+    {"createArmies", {"regimentsPerTroop"}},       // Read by warsAndRebels.
+    {"cultureAndReligion", {"dynamicReligions"}},  // Read by warsAndRebels.
+};
+
+// The config and custom_overrides keys each conversion stage reads,
+// including through its helpers. Keys listed for no stage count as inputs
+// to the first one, so leaving a key out entirely costs reuse but never
+// correctness. A key must be listed under the first stage that reads it,
+// though: listed only under a later one, a change to it leaves the
+// checkpoints of the stages in between looking valid while stale.
+struct StageInputs {
+  vector<string> config;
+  vector<string> custom;
+};
+
+const map<string, StageInputs> kStageInputs = {
+    {"createCK2Objects", {{}, {"heir_overrides", "custom_score"}}},
+    {"pruneCK2Game", {{"prune_ck2"}, {}}},
+    {"createCountryMap",
+     {{"max_unions", "max_vassals_per_kingdom", "permit_subinfeudation"},
+      {"provinces_for_tags", "country_overrides"}}},
+    {"calculateProvinceWeights",
+     {{"minimumWeights"}, {"government_weights", "special_nerfs"}}},
+    {"transferProvinces", {{"debug_names"}, {}}},
+    {"modifyProvinces",
+     {{"redistribute_dev", "float_dev_values"}, {"trade_zone_modifiers"}}},
+    {"adjustBalkanisation",
+     {{"balkan_threshold", "max_balkanisation", "min_balkanisation"}, {}}},
+    {"moveBuildings", {{"fort_influence"}, {}}},
+    {"cleanEU4Nations",
+     {{"default_missions", "keys_to_clear", "keys_to_remove",
+       "keys_to_remove_on_zero_provs"},
+      {"custom_colors", "custom_ideas"}}},
+    {"createArmies",
+     {{"cavalry_type", "infantry_per_cavalry", "infantry_type",
+       "make_average", "retinue_weight", "troops"},
+      {}}},
+    {"createNavies", {{"allowNavies", "forbidNavies", "ships"}, {}}},
+    {"cultureAndReligion",
+     {{"accepted_culture_threshold", "dynamicReligions", "overwrite_culture",
+       "split_cutoff"},
+      {"culture_overrides", "religion_overrides"}}},
+    {"createGovernments",
+     {{"empire_threshold", "governments", "kingdom_threshold"},
+      {"governments"}}},
+    {"createCharacters", {{"bonusTraits", "generalSkills", "default_stats"}, {}}},
+    {"redistributeMana", {{"minimum_legitimacy"}, {"custom_score"}}},
+    {"hreAndPapacy",
+     {{"hre"},
+      {"electors", "empire_dynasties", "empire_force_title",
+       "empire_religions"}}},
+    {"warsAndRebels",
+     {{"convertWars", "dynamicReligions", "generalSkills", "infantry_type",
+       "rebel_faction_types", "rebel_heresies", "troops", "default_stats"},
+      {}}},
+    {"greatWorks", {{"great_works"}, {}}},
+    {"displayStats", {{"statistics"}, {}}},
+    // These always run after the stages, so their inputs need no tracking.
+    {"calculateDynasticScores",
+     {{"median_mana"},
+      {"custom_score", "custom_score_title_points", "custom_score_traits"}}},
+    {"cleanUp", {{"cavalry_type", "infantry_type"}, {}}},
+};
+
+// Config keys that do not affect the converted save; regimentsPerTroop is
+// set by createArmies rather than read from the file.
+const unordered_set<string> kUntrackedConfig = {
+    "streams", "checkpoints", "allocation_profile", "diff_saves",
+    "census_lines", "world_export", "prefetch_files", "regimentsPerTroop",
+    "verify_reset"};
+
+unsigned long long hashKey (Object* obj, const TreeHashes& hashes,
+                            const string& key) {
+  unsigned long long hash = hashText(key);
+  for (auto* value : obj->getValue(key)) {
+    hash = combineHashes(hash, hashes.get(value));
+  }
+  return hash;
+}
+}
+
+namespace {
+// getNeededObject leaves an empty object behind for a key the file lacks;
+// readers cannot tell that from no key at all.
+bool onlyEmpty (Object* obj, const string& key) {
+  for (auto* value : obj->getValue(key)) {
+    if (value->isLeaf() || value->numTokens() > 0) return false;
+    if (!value->getLeaves().empty()) return false;
+  }
+  return true;
+}
+
+// The top-level keys whose values differ between config and loaded.
+vector<string> changedConfigKeys (Object* config, Object* loaded) {
+  TreeHashes configHashes;
+  TreeHashes loadedHashes;
+  configHashes.compute(config);
+  loadedHashes.compute(loaded);
+  set<string> keys;
+  for (auto* leaf : config->getLeaves()) keys.insert(leaf->getKey());
+  for (auto* leaf : loaded->getLeaves()) keys.insert(leaf->getKey());
+  vector<string> changed;
+  for (const auto& key : keys) {
+    if (hashKey(config, configHashes, key) ==
+        hashKey(loaded, loadedHashes, key)) {
       continue;
-    if (oldObject) {
+    }
+    if (loaded->getValue(key).empty() && onlyEmpty(config, key)) continue;
+    changed.push_back(key);
+  }
+  return changed;
+}
+}
+
+// Stages leave entries in the config for later stages to read, see
+// kStageConfigOutputs, and calculateProvinceWeights grafts custom sections
+// into minimumWeights. Put back each top-level entry as config.txt had it.
+// This is done in place, since calculateTroopWeight keeps a pointer into
+// the config across jobs.
+void Converter::restoreConfig () {
+  for (const auto& key : changedConfigKeys(configObject, configLoaded)) {
+    Logger::logStream(LogStream::Debug)
+        << "Restoring config entry " << key << ".\n";
+    configObject->unsetValue(key);
+    for (auto* value : configLoaded->getValue(key)) {
+      configObject->setValue(new Object(value));
+    }
+  }
+}
+
+// Checks that a cancelled job left nothing for the next one to trip over:
+// the CK save must hash as it did when loaded, and the config must match
+// config.txt. A conversion run after the reset then starts from the same
+// state as one run after a fresh load, and so gives the same output.
+void Converter::verifyReset () {
+  bool clean = true;
+  if (ck2LoadedHash == 0) {
+    Logger::logStream(LogStream::Info)
+        << "Save was loaded before verify_reset was set, not checking it.\n";
+  } else {
+    TreeHashes ck2Hashes;
+    ck2Hashes.compute(ck2Game);
+    if (ck2Hashes.get(ck2Game) != ck2LoadedHash) {
+      Logger::logStream(LogStream::Warn)
+          << "After reset, the CK save differs from the file as loaded.\n";
+      clean = false;
+    }
+  }
+  for (const auto& key : changedConfigKeys(configObject, configLoaded)) {
+    Logger::logStream(LogStream::Warn)
+        << "After reset, config entry " << key
+        << " differs from config.txt.\n";
+    clean = false;
+  }
+  if (clean) {
+    Logger::logStream(LogStream::Info)
+        << "Reset verified, save and config are as loaded.\n";
+  }
+}
+
+// Fingerprints each conversion stage by what it reads: its config and
+// custom_overrides keys, plus the fingerprint of the stage before it,
+// which stands for the state it is handed. The first stage also takes the
+// CK save, input.eu4, the maps files and every key no stage claims. A
+// checkpoint is reused only if its stage's fingerprint is unchanged.
+void Converter::fingerprintStages (const vector<string>& stages) {
+  stageFingerprints.clear();
+  TreeHashes configHashes;
+  TreeHashes customHashes;
+  configHashes.compute(configObject);
+  customHashes.compute(customObject);
+
+  set<string> claimedConfig(kUntrackedConfig.begin(), kUntrackedConfig.end());
+  set<string> claimedCustom;
+  for (const auto& inputs : kStageInputs) {
+    claimedConfig.insert(inputs.second.config.begin(), inputs.second.config.end());
+    claimedCustom.insert(inputs.second.custom.begin(), inputs.second.custom.end());
+  }
+
+  string dirToUse = remQuotes(configObject->safeGetString("maps_dir", ".\\maps\\"));
+  unsigned long long hash = hashFile(ck2FileName);
+  hash = combineHashes(hash, hashFile(dirToUse + "input.eu4"));
+  for (const auto& name : kMapsFiles) {
+    hash = combineHashes(hash, hashFile(dirToUse + name));
+  }
+  set<string> unclaimedConfig;
+  for (auto* leaf : configObject->getLeaves()) {
+    if (!claimedConfig.count(leaf->getKey())) unclaimedConfig.insert(leaf->getKey());
+  }
+  for (const auto& key : unclaimedConfig) {
+    hash = combineHashes(hash, hashKey(configObject, configHashes, key));
+  }
+  set<string> unclaimedCustom;
+  for (auto* leaf : customObject->getLeaves()) {
+    if (!claimedCustom.count(leaf->getKey())) unclaimedCustom.insert(leaf->getKey());
+  }
+  for (const auto& key : unclaimedCustom) {
+    hash = combineHashes(hash, hashKey(customObject, customHashes, key));
+  }
+
+  for (const auto& stage : stages) {
+    hash = combineHashes(hash, hashText(stage));
+    auto inputs = kStageInputs.find(stage);
+    if (inputs != kStageInputs.end()) {
+      for (const auto& key : inputs->second.config) {
+        hash = combineHashes(hash, hashKey(configObject, configHashes, key));
+      }
+      for (const auto& key : inputs->second.custom) {
+        hash = combineHashes(hash, hashKey(customObject, customHashes, key));
+      }
+    }
+    stageFingerprints[stage] = createString("%016llx", hash);
+  }
+}
+
+// A checkpoint is eu4Game as it stands after a stage, plus what the
+// skipped stages leave outside the save: which CK ruler and title each
+// EU4 country converts, which provinces it holds, the culture and religion
+// maps, the pending independence revolts, and kStageConfigOutputs. The
+// stage list in convert notes what each skipped stage leaves behind.
+void Converter::writeCheckpoint (const string& stage) {
+  Logger::logStream(LogStream::Info) << "Writing checkpoint after " << stage << ".\n";
+  Object* record = new Object(kCheckpointKey);
+  record->setLeaf("stage", stage);
+  Object* fingerprints = record->getNeededObject("fingerprints");
+  Object* config = record->getNeededObject("config");
+  for (const auto& name : progressStages) {
+    fingerprints->setLeaf(name, stageFingerprints[name]);
+    auto outputs = kStageConfigOutputs.find(name);
+    if (outputs != kStageConfigOutputs.end()) {
+      for (const auto& key : outputs->second) {
+        for (auto* value : configObject->getValue(key)) {
+          config->setValue(new Object(value));
+        }
+      }
+    }
+    if (name == stage) break;
+  }
+  Object* countries = record->getNeededObject("countries");
+  for (auto* eu4country : EU4Country::getAll()) {
+    CK2Ruler* ruler = eu4country->getRuler();
+    if (!ruler && eu4country->getProvinces().empty()) continue;
+    Object* country = countries->getNeededObject(eu4country->getKey());
+    if (ruler) {
+      country->setLeaf("ruler", ruler->getKey());
+      country->setLeaf("title", eu4country->getTitle()->getKey());
+    }
+    Object* provinces = country->getNeededObject("provinces");
+    for (auto* eu4prov : eu4country->getProvinces()) {
+      provinces->addToList(eu4prov->getKey());
+    }
+  }
+  Object* revolts = record->getNeededObject("revolts");
+  for (auto* revolter : independenceRevolts) {
+    revolts->addToList(revolter->getKey());
+  }
+  for (const auto& conversion : {make_pair("cultures", &cultureMap),
+                           make_pair("religions", &religionMap)}) {
+    Object* mapObject = record->getNeededObject(conversion.first);
+    for (const auto& entry : *conversion.second) {
+      Object* targets = mapObject->getNeededObject(entry.first);
+      for (const auto& target : entry.second) {
+        targets->addToList(target);
+      }
+    }
+  }
+
+  idAllocator.flush(eu4Game);
+  eu4Game->setValue(record);
+  ofstream writer(checkpointFile(stage).c_str());
+  ParseOptions options;
+  options.topLevel = eu4Game;
+  writeObject(writer, eu4Game, options);
+  eu4Game->removeObject(record);
+  delete record;
+}
+
+// Looks for the checkpoint of the latest stage whose inputs are unchanged,
+// see fingerprintStages, and swaps it in for eu4Game. Returns the stage,
+// or the empty string if there is nothing to resume from.
+string Converter::loadCheckpoint (const vector<string>& stages) {
+  for (auto stage = stages.rbegin(); stage != stages.rend(); ++stage) {
+    ifstream reader(checkpointFile(*stage).c_str());
+    if (!reader.good()) continue;
+    reader.close();
+    Object* checkpoint = loadTextFile(checkpointFile(*stage));
+    Object* record = checkpoint ? checkpoint->safeGetObject(kCheckpointKey) : nullptr;
+    Object* fingerprints = record ? record->getNeededObject("fingerprints") : nullptr;
+    if (!fingerprints ||
+        fingerprints->safeGetString(*stage) != stageFingerprints[*stage]) {
+      string changed = *stage;
+      for (const auto& name : stages) {
+        if (!fingerprints ||
+            fingerprints->safeGetString(name) != stageFingerprints[name]) {
+          changed = name;
+          break;
+        }
+      }
       Logger::logStream(LogStream::Info)
-          << "Detected old keyword '" << old_string
-          << "', proceeding with that.\n";
-      *target = old_string;
-      return;
+          << "Checkpoint after " << *stage << " is out of date, inputs of "
+          << changed << " changed.\n";
+      delete checkpoint;
+      continue;
     }
-    if (newObject) {
-      return;
+    checkpoint->removeObject(record);
+    delete checkpointRecord;
+    checkpointRecord = record;
+    delete eu4Game;
+    eu4Game = checkpoint;
+    Logger::logStream(LogStream::Info) << "Resuming after " << *stage << ".\n";
+    return *stage;
+  }
+  Logger::logStream(LogStream::Info) << "No checkpoint to resume from.\n";
+  return "";
+}
+
+// Stands in for createCountryMap when resuming; needs the CK and EU4
+// wrappers to exist.
+bool Converter::restoreCheckpoint () {
+  if (!checkpointRecord) return false;
+  Logger::logStream(LogStream::Info) << "Restoring checkpoint links.\n" << LogOption::Indent;
+  for (auto* country : checkpointRecord->getNeededObject("countries")->getLeaves()) {
+    EU4Country* eu4country = EU4Country::findByName(country->getKey());
+    if (!eu4country) {
+      Logger::logStream(LogStream::Error)
+          << "Could not find country " << country->getKey()
+          << " from checkpoint.\n" << LogOption::Undent;
+      return false;
+    }
+    string rulerId = country->safeGetString("ruler", PlainNone);
+    if (rulerId != PlainNone) {
+      CK2Ruler* ruler = CK2Ruler::findByName(rulerId);
+      CK2Title* title = CK2Title::findByName(country->safeGetString("title"));
+      if (!ruler || !title) {
+        Logger::logStream(LogStream::Error)
+            << "Could not find ruler " << rulerId << " of "
+            << country->getKey() << " from checkpoint.\n" << LogOption::Undent;
+        return false;
+      }
+      eu4country->setRuler(ruler, title);
+    }
+    Object* provinces = country->getNeededObject("provinces");
+    for (int i = 0; i < provinces->numTokens(); ++i) {
+      EU4Province* eu4prov = EU4Province::findByName(provinces->getToken(i));
+      if (eu4prov) eu4prov->restoreCountry(eu4country);
+    }
+  }
+  set<string> restoredConfig;
+  for (auto* value : checkpointRecord->getNeededObject("config")->getLeaves()) {
+    if (restoredConfig.insert(value->getKey()).second) {
+      configObject->unsetValue(value->getKey());
+    }
+    configObject->setValue(new Object(value));
+  }
+  Object* revolts = checkpointRecord->getNeededObject("revolts");
+  for (int i = 0; i < revolts->numTokens(); ++i) {
+    EU4Country* revolter = EU4Country::findByName(revolts->getToken(i));
+    if (revolter) independenceRevolts.insert(revolter);
+  }
+  for (const auto& conversion : {make_pair("cultures", &cultureMap),
+                           make_pair("religions", &religionMap)}) {
+    for (auto* entry : checkpointRecord->getNeededObject(conversion.first)->getLeaves()) {
+      vector<string>& targets = (*conversion.second)[entry->getKey()];
+      for (int i = 0; i < entry->numTokens(); ++i) {
+        targets.push_back(entry->getToken(i));
+      }
     }
   }
-  Logger::logStream(LogStream::Warn)
-      << "Reached end of detectChangedString for " << old_string << " vs "
-      << new_string << ", may indicate bug.\n";
+  delete checkpointRecord;
+  checkpointRecord = 0;
+  Logger::logStream(LogStream::Info) << "Done restoring checkpoint.\n" << LogOption::Undent;
+  return true;
+}
+
+// Settles the spelling of every keyword in one walk over objects: each
+// object's keys are read once, and the walk stops as soon as every keyword
+// has been seen in either form. Keywords never seen keep the new spelling.
+void detectChangedStrings(const ChangedKeyword* keywords, int numKeywords,
+                          const objvec& objects) {
+  // Key to keyword index, negated-and-offset for the old spelling.
+  unordered_map<string, int> spellings;
+  for (int i = 0; i < numKeywords; ++i) {
+    *keywords[i].target = keywords[i].newKey;
+    spellings[keywords[i].newKey] = i;
+    spellings[keywords[i].oldKey] = -1 - i;
+  }
+  vector<bool> decided(numKeywords, false);
+  int undecided = numKeywords;
+  for (auto* obj : objects) {
+    if (undecided == 0) break;
+    vector<int> seen(numKeywords, 0);
+    for (auto* leaf : obj->getLeaves()) {
+      auto spelling = spellings.find(leaf->getKey());
+      if (spelling == spellings.end()) continue;
+      int index = spelling->second;
+      if (index < 0) {
+        seen[-1 - index] = -1;
+      } else if (seen[index] == 0) {
+        seen[index] = 1;
+      }
+    }
+    for (int i = 0; i < numKeywords; ++i) {
+      if (decided[i] || seen[i] == 0) continue;
+      decided[i] = true;
+      --undecided;
+      if (seen[i] < 0) {
+        Logger::logStream(LogStream::Info)
+            << "Detected old keyword '" << keywords[i].oldKey
+            << "', proceeding with that.\n";
+        *keywords[i].target = keywords[i].oldKey;
+      }
+    }
+  }
+  for (int i = 0; i < numKeywords; ++i) {
+    if (decided[i]) continue;
+    Logger::logStream(LogStream::Warn)
+        << "Reached end of detectChangedStrings for " << keywords[i].oldKey
+        << " vs " << keywords[i].newKey << ", may indicate bug.\n";
+  }
 }
 
 /********************************  End helpers  **********************/
@@ -798,6 +2063,8 @@ void detectChangedString(const string& old_string, const string& new_string,
 
 bool Converter::createCK2Objects () {
   Logger::logStream(LogStream::Info) << "Creating CK2 objects\n" << LogOption::Indent;
+  // From here the wrappers, and the stages after them, write into the save.
+  ck2Modified = true;
   gameDate = remQuotes(ck2Game->safeGetString("date", "\"1444.11.10\""));
   gameDays = days(gameDate);
   if (gameDays == 0) {
@@ -814,7 +2081,8 @@ bool Converter::createCK2Objects () {
   }
 
   objvec provinces = wrapperObject->getLeaves();
-  detectChangedString(kOldTradePost, kNewTradePost, provinces, &tradePostString);
+  const ChangedKeyword tradePost = {kOldTradePost, kNewTradePost, &tradePostString};
+  detectChangedStrings(&tradePost, 1, provinces);
   for (objiter province = provinces.begin(); province != provinces.end();
        ++province) {
     new CK2Province(*province);
@@ -878,23 +2146,7 @@ bool Converter::createCK2Objects () {
   }
 
   objvec charObjs = characters->getLeaves();
-  detectChangedString(kOldDemesne, kNewDemesne, charObjs, &demesneString);
-  detectChangedString(kOldBirthName, kNewBirthName, charObjs, &birthNameString);
-  detectChangedString(kOldBirthDate, kNewBirthDate, charObjs, &birthDateString);
-  detectChangedString(kOldDynasty, kNewDynasty, charObjs, &dynastyString);
-  detectChangedString(kOldAttributes, kNewAttributes, charObjs,
-                      &attributesString);
-  detectChangedString(kOldPrestige, kNewPrestige, charObjs, &prestigeString);
-  detectChangedString(kOldJobTitle, kNewJobTitle, charObjs, &jobTitleString);
-  detectChangedString(kOldEmployer, kNewEmployer, charObjs, &employerString);
-  detectChangedString(kOldFather, kNewFather, charObjs, &fatherString);
-  detectChangedString(kOldMother, kNewMother, charObjs, &motherString);
-  detectChangedString(kOldFemale, kNewFemale, charObjs, &femaleString);
-  detectChangedString(kOldGovernment, kNewGovernment, charObjs,
-                      &governmentString);
-  detectChangedString(kOldDeadCharHoldings, kNewDeadCharHoldings, charObjs,
-                      &deadCharHoldingsString);
-  detectChangedString(kOldTraits, kNewTraits, charObjs, &traitString);
+  detectChangedStrings(kCharacterKeywords, kNumCharacterKeywords, charObjs);
 
   Logger::logStream(LogStream::Info)
       << "Using keywords: " << demesneString << ", " << birthNameString << ", "
@@ -951,11 +2203,51 @@ bool Converter::createCK2Objects () {
     (*ruler)->createClaims();
   }
 
+  unordered_set<string> scoredDynasties;
+  if (customObject) {
+    for (auto* custom : customObject->getNeededObject("custom_score")->getLeaves()) {
+      for (auto* dyn : custom->getValue("dynasty")) {
+        scoredDynasties.insert(dyn->getLeaf());
+      }
+    }
+  }
+  scoredCharacters.clear();
+
+  // Living characters that may need wrapping, by id; rulers are already
+  // wrapped.
+  unordered_map<int, Object*> livingCharacters;
+  unordered_map<int, CK2Character*> wrappers;
+  for (auto* ruler : CK2Ruler::getAll()) {
+    wrappers[atoi(ruler->getKey().c_str())] = ruler;
+  }
+  auto wrap = [&](int charId) -> CK2Character* {
+    CK2Character*& wrapper = wrappers[charId];
+    if (wrapper == nullptr) {
+      wrapper = new CK2Character(livingCharacters[charId], dynasties);
+    }
+    return wrapper;
+  };
+  CharacterGraph& characterGraph = CK2Character::relations;
+  characterGraph.clear();
+  vector<int> claimants;
+
+  // This is the only walk over the full character section; anything later
+  // stages need from unwrapped characters must be collected here.
   map<string, int> dynastyPower;
-  objvec allChars = characters->getLeaves();
   Logger::logStream(LogStream::Info) << "Calculating dynasty power\n";
-  for (objiter ch = allChars.begin(); ch != allChars.end(); ++ch) {
+  setStageItems(charObjs.size());
+  for (objiter ch = charObjs.begin(); ch != charObjs.end(); ++ch) {
+    if (cancelled()) {
+      Logger::logStream(LogStream::Info) << "Cancelled.\n" << LogOption::Undent;
+      return false;
+    }
+    advanceStage();
+    AllocationSite site("character walk");
     std::string charTag = (*ch)->getKey();
+    if (!scoredDynasties.empty() &&
+        scoredDynasties.count((*ch)->safeGetString(dynastyString, PlainNone))) {
+      scoredCharacters[charTag] = (*ch);
+    }
     if ((*ch)->safeGetString("d_d", PlainNone) != PlainNone) {
       // Dead character, check for dynasty power.
       string dynastyId = (*ch)->safeGetString(dynastyString, PlainNone);
@@ -969,20 +2261,29 @@ bool Converter::createCK2Objects () {
       continue;
     }
 
-    objvec claims = (*ch)->getValue("claim");
-    CK2Ruler* father = CK2Ruler::findByName((*ch)->safeGetString(fatherString));
-    CK2Ruler* mother = CK2Ruler::findByName((*ch)->safeGetString(motherString));
-    CK2Ruler* employer = nullptr;
+    int charId = atoi(charTag.c_str());
+    livingCharacters[charId] = (*ch);
+    characterGraph.addEdge((*ch)->safeGetInt(fatherString), charId,
+                           CharacterRelation::Parent);
+    characterGraph.addEdge((*ch)->safeGetInt(motherString), charId,
+                           CharacterRelation::Parent);
+    for (auto* sp : (*ch)->getValue("spouse")) {
+      characterGraph.addEdge(atoi(sp->getLeaf().c_str()), charId,
+                             CharacterRelation::Spouse);
+    }
+    // Only office-holders count as employed.
     if (((*ch)->safeGetString(jobTitleString, PlainNone) != PlainNone) ||
 	((*ch)->safeGetString("title", PlainNone) == "\"title_commander\"") ||
 	((*ch)->safeGetString("title", PlainNone) == "\"title_high_admiral\"")) {
-      employer = CK2Ruler::findByName((*ch)->safeGetString(employerString));
+      characterGraph.addEdge((*ch)->safeGetInt(employerString), charId,
+                             CharacterRelation::Employer);
     }
-    CK2Character* current = CK2Ruler::findByName(charTag);
+    if ((*ch)->safeGetObject("claim")) {
+      claimants.push_back(charId);
+    }
+
     if (heirMap.find(charTag) != heirMap.end()) {
-      if (current == nullptr) {
-        current = new CK2Character((*ch), dynasties);
-      }
+      CK2Character* current = wrap(charId);
       CK2Ruler* ruler = CK2Ruler::findByName(heirMap[charTag]);
       if (ruler != nullptr) {
         Logger::logStream("characters")
@@ -991,24 +2292,26 @@ bool Converter::createCK2Objects () {
         ruler->overrideHeir(current);
       }
     }
-    for (auto* sp : (*ch)->getValue("spouse")) {
-      CK2Ruler* spouse = CK2Ruler::findByName(sp->getLeaf());
-      if (!spouse) {
-        continue;
-      }
-      if (current == nullptr) {
-        current = new CK2Character((*ch), dynasties);
+  }
+  characterGraph.build();
+  Logger::logStream("characters")
+      << "Built " << characterGraph.numEdges() << " character relations.\n";
+
+  // Each ruler's relations are one contiguous range, in save order.
+  for (auto* ruler : CK2Ruler::getAll()) {
+    int rulerId = atoi(ruler->getKey().c_str());
+    for (auto edge = characterGraph.startEdge(rulerId);
+         edge != characterGraph.finalEdge(rulerId); ++edge) {
+      if (edge->relation == CharacterRelation::Spouse) {
+        ruler->addSpouse(wrap(edge->target));
+      } else if (edge->relation == CharacterRelation::Parent ||
+                 edge->relation == CharacterRelation::Employer) {
+        ruler->personOfInterest(wrap(edge->target));
       }
-      spouse->addSpouse(current);
-    }
-    if ((!father) && (!mother) && (!employer) && (0 == claims.size())) continue;
-    if (current == nullptr) {
-      current = new CK2Character((*ch), dynasties);
     }
-    if (father) father->personOfInterest(current);
-    if (mother) mother->personOfInterest(current);
-    if (employer) employer->personOfInterest(current);
-    current->createClaims();
+  }
+  for (int charId : claimants) {
+    wrap(charId)->createClaims();
   }
 
   for (CK2Ruler::Iter ruler = CK2Ruler::start(); ruler != CK2Ruler::final(); ++ruler) {
@@ -1046,7 +2349,8 @@ bool Converter::createCK2Objects () {
     new CK2War(*war);
   }
   Logger::logStream(LogStream::Info) << "Created " << CK2War::totalAmount() << " CK2 wars.\n";
-  
+
+  CK2Title::flattenHierarchies();
   Logger::logStream(LogStream::Info) << "Done with CK2 objects.\n" << LogOption::Undent;
   return true;
 }
@@ -1573,11 +2877,10 @@ void Converter::loadFiles () {
   string secondary_input =
       customObject->safeGetString("province_overrides", PlainNone);
 
-  Parser::ignoreString = "EU4txt";
-  Parser::specialCases["map_area_data{"] = "map_area_data={";
-  eu4Game = loadTextFile(dirToUse + "input.eu4");
-  Parser::specialCases.clear();
-  Parser::ignoreString = "";
+  // Wrappers from an earlier job point into the previous eu4Game.
+  clearWrappers();
+  if (eu4Game) delete eu4Game;
+  eu4Game = loadTextFile(dirToUse + "input.eu4", eu4SaveOptions());
   provinceMapObject = loadTextFile(dirToUse + "provinces.txt");
   deJureObject = loadTextFile(dirToUse + "de_jure_lieges.txt");
   ckBuildingObject = loadTextFile(dirToUse + "ck_buildings.txt");
@@ -1605,9 +2908,77 @@ void Converter::loadFiles () {
     Logger::logStream(LogStream::Warn)
         << "Couldn't find EU4 provinces object, this will cause errors later.\n";
   }
+  // Anything prefetched but not asked for is dropped.
+  for (auto& file : prefetchedFiles) delete file.second;
+  prefetchedFiles.clear();
+  prefetchNames.clear();
   Logger::logStream(LogStream::Info) << "Done loading input files\n" << LogOption::Undent;
 }
 
+// Starts parsing input.eu4 and the maps files on a background thread while
+// the CK2 save is parsed, so that loadFiles finds them ready. Each file is
+// read twice: a raw read first, which is all that overlaps with the CK2
+// parse, and then the parse, which queues behind the CK2 parse on the
+// parser lock.
+void Converter::prefetchFiles () {
+  if (prefetch) return;
+  if (configObject->safeGetString("prefetch_files", "yes") != "yes") return;
+  string dirToUse = remQuotes(configObject->safeGetString("maps_dir", ".\\maps\\"));
+  vector<pair<string, ParseOptions> > files;
+  string overrideFileName = remQuotes(configObject->safeGetString("custom", QuotedNone));
+  if ((PlainNone != overrideFileName) && (overrideFileName != "NOCUSTOM")) {
+    files.emplace_back(dirToUse + overrideFileName, ParseOptions());
+  }
+  files.emplace_back(dirToUse + "input.eu4", eu4SaveOptions());
+  for (const auto& name : kMapsFiles) {
+    files.emplace_back(dirToUse + name, ParseOptions());
+  }
+  prefetchNames.clear();
+  for (const auto& file : files) {
+    prefetchNames.insert(file.first);
+  }
+
+  // No logging from here on; the Logger belongs to the worker thread.
+  auto state = std::make_shared<PrefetchState>();
+  prefetch = state;
+  std::thread([state, files] () {
+    vector<char> buffer(1 << 20);
+    for (const auto& file : files) {
+      ifstream reader(file.first.c_str(), ios::binary);
+      while (reader.read(&buffer[0], buffer.size())) {}
+    }
+    map<string, Object*> parsed;
+    for (const auto& file : files) {
+      if (state->isAbandoned()) break;
+      ifstream reader(file.first.c_str());
+      if (!reader.good()) continue; // Reported when loadTextFile asks for it.
+      reader.close();
+      parsed[file.first] = parseFile(file.first, file.second);
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->abandoned) {
+      for (auto& file : parsed) delete file.second;
+      return;
+    }
+    state->parsed.swap(parsed);
+    state->finished = true;
+    state->ready.notify_all();
+  }).detach();
+}
+
+// Waits for the prefetch thread and takes over what it parsed.
+void Converter::collectPrefetch () {
+  if (!prefetch) return;
+  auto state = prefetch;
+  prefetch.reset();
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->ready.wait(lock, [state] () {return state->finished;});
+  for (auto& file : state->parsed) {
+    prefetchedFiles[file.first] = file.second;
+  }
+  state->parsed.clear();
+}
+
 void Converter::setDynastyNames (Object* dynastyNames) {
   if (!dynastyNames) {
     Logger::logStream(LogStream::Warn) << "Warning: Did not find "
@@ -1639,31 +3010,167 @@ void Converter::setDynastyNames (Object* dynastyNames) {
   }
 }
 
+bool Converter::pruneCK2Game () {
+  Object* pruneConfig = configObject->safeGetObject("prune_ck2");
+  if (!pruneConfig || pruneConfig->safeGetString("prune", "no") != "yes") {
+    return true;
+  }
+  Logger::logStream(LogStream::Info) << "Pruning CK2 save\n" << LogOption::Indent;
+
+  // Top-level sections not listed are never read after this point.
+  Object* keepObject = pruneConfig->getNeededObject("keep_sections");
+  unordered_set<string> keepSections;
+  for (int i = 0; i < keepObject->numTokens(); ++i) {
+    keepSections.insert(keepObject->getToken(i));
+  }
+  int droppedSections = 0;
+  if (keepSections.empty()) {
+    Logger::logStream(LogStream::Warn)
+        << "No sections listed in keep_sections, not pruning sections.\n";
+  } else {
+    unordered_set<Object*> dropped;
+    for (auto* section : ck2Game->getLeaves()) {
+      if (keepSections.count(section->getKey())) continue;
+      dropped.insert(section);
+    }
+    removeChildren(ck2Game, dropped);
+    for (auto* section : dropped) {
+      delete section;
+    }
+    droppedSections = dropped.size();
+  }
+
+  // Unwrapped characters only matter to the dynasty scores, and then only
+  // for their dynasty, name and traits.
+  Object* keepKeysObject = pruneConfig->getNeededObject("keep_character_keys");
+  unordered_set<string> keepKeys;
+  keepKeys.insert(dynastyString);
+  keepKeys.insert(traitString);
+  keepKeys.insert(birthNameString);
+  for (int i = 0; i < keepKeysObject->numTokens(); ++i) {
+    keepKeys.insert(keepKeysObject->getToken(i));
+  }
+
+  int droppedCharacters = 0;
+  int strippedCharacters = 0;
+  Object* characters = ck2Game->getNeededObject("character");
+  unordered_set<Object*> droppedChars;
+  AllocationSite site("strip characters");
+  for (auto* character : characters->getLeaves()) {
+    if (CK2Character::isWrapped(character)) continue;
+    if (!scoredCharacters.count(character->getKey())) {
+      droppedChars.insert(character);
+      continue;
+    }
+    unordered_set<Object*> fields;
+    for (auto* field : character->getLeaves()) {
+      if (keepKeys.count(field->getKey())) continue;
+      fields.insert(field);
+    }
+    removeChildren(character, fields);
+    for (auto* field : fields) {
+      delete field;
+    }
+    ++strippedCharacters;
+  }
+  removeChildren(characters, droppedChars);
+  for (auto* character : droppedChars) {
+    delete character;
+  }
+  droppedCharacters = droppedChars.size();
+
+  Logger::logStream(LogStream::Info)
+      << "Dropped " << droppedSections << " sections and "
+      << droppedCharacters << " characters, stripped " << strippedCharacters
+      << " characters.\n" << LogOption::Undent;
+  return true;
+}
+
 /******************************* End initialisers *******************************/ 
 
 
 /******************************* Begin conversions ********************************/
 
-double getVassalPercentage(pair<EU4Country* const, vector<EU4Country*>>& lord,
-                           map<EU4Country*, int>& ownerMap) {
-  double total = 0;
-  if (ownerMap.find(lord.first) != ownerMap.end()) {
-    total = ownerMap.at(lord.first);
-  } else {
-    Logger::logStream(LogStream::Warn)
-        << "Could not find overlord " << lord.first->getName() << " in owner map.\n";
+namespace {
+// Province counts of an overlord and its subjects while balkanisation
+// moves provinces between them. The subjects' total is kept up to date on
+// every transfer and the subjects are held ordered by size, so a transfer
+// costs O(log subjects) instead of a rescan of the bloc.
+class SubjectBloc {
+public:
+  SubjectBloc (EU4Country* o, const vector<EU4Country*>& subjects,
+               map<EU4Country*, int>& counts)
+    : overlord(o)
+    , ownerMap(counts)
+    , subjectTotal(0)
+  {
+    if (ownerMap.find(overlord) == ownerMap.end()) {
+      Logger::logStream(LogStream::Warn)
+          << "Could not find overlord " << overlord->getName() << " in owner map.\n";
+    }
+    // Listed twice, a subject counts twice, as it always has.
+    for (auto* subject : subjects) {
+      subjectTotal += ownerMap[subject];
+      if (multiplicity[subject]++ > 0) continue;
+      position[subject] = inOrder.size();
+      ranked.insert(make_pair(ownerMap[subject], position[subject]));
+      inOrder.push_back(subject);
+    }
   }
 
-  double vassals = 0;
-  for (auto* subject : lord.second) {
-    double curr = ownerMap[subject];
-    total += curr;
-    vassals += curr;
+  int provinces (EU4Country* country) const {
+    auto count = ownerMap.find(country);
+    return count == ownerMap.end() ? 0 : count->second;
   }
-  if (0 == total) {
-    return 0;
+
+  double vassalPercentage () const {
+    double total = provinces(overlord) + subjectTotal;
+    if (0 == total) return 0;
+    return subjectTotal / total;
+  }
+
+  // Moves one province's worth of count from one country to another.
+  void transfer (EU4Country* from, EU4Country* to) {
+    adjust(from, -1);
+    adjust(to, 1);
   }
-  return vassals / total;
+
+  // The smallest subject not yet attempted, earlier subjects winning ties;
+  // with skipEmpty, subjects without provinces are passed over too. As in
+  // the scan this replaces, once the first subject has been attempted only
+  // a strictly smaller one is taken. Null if there is none.
+  EU4Country* smallestSubject (const set<EU4Country*>& attempted, bool skipEmpty) const {
+    EU4Country* first = inOrder[0];
+    bool firstBlocks = attempted.count(first) && (!skipEmpty || provinces(first) > 0);
+    for (const auto& rank : ranked) {
+      EU4Country* subject = inOrder[rank.second];
+      if (attempted.count(subject)) continue;
+      if (skipEmpty && 0 == rank.first) continue;
+      if (firstBlocks && rank.first >= provinces(first)) return nullptr;
+      return subject;
+    }
+    return nullptr;
+  }
+
+private:
+  void adjust (EU4Country* country, int change) {
+    auto mult = multiplicity.find(country);
+    if (mult != multiplicity.end()) {
+      ranked.erase(make_pair(ownerMap[country], position[country]));
+      ranked.insert(make_pair(ownerMap[country] + change, position[country]));
+      subjectTotal += change * mult->second;
+    }
+    ownerMap[country] += change;
+  }
+
+  EU4Country* overlord;
+  map<EU4Country*, int>& ownerMap;
+  double subjectTotal;
+  vector<EU4Country*> inOrder;
+  unordered_map<EU4Country*, int> position;
+  unordered_map<EU4Country*, int> multiplicity;
+  set<pair<int, int> > ranked; // Province count, then position.
+};
 }
 
 void constructOwnerMap (map<EU4Country*, int>* ownerMap) {
@@ -1805,13 +3312,33 @@ bool Converter::adjustBalkanisation () {
   for (auto& lord : subjectMap) {
     if (lord.second.empty()) continue;
     EU4Country* overlord = lord.first;
-    double vassalPercentage = getVassalPercentage(lord, ownerMap);
+    SubjectBloc bloc(overlord, lord.second, ownerMap);
+    double vassalPercentage = bloc.vassalPercentage();
     bool dent = false;
     bool printed = false;
+    // The overlord's provinces by the CK kingdoms they overlap, in its own
+    // order; provinces only leave the overlord while balkanising, so each
+    // list is walked once.
+    map<CK2Title*, vector<EU4Province*> > candidates;
+    map<CK2Title*, unsigned int> nextCandidate;
+    if (vassalPercentage < minBalkan) {
+      for (auto* eu4prov : overlord->getProvinces()) {
+        set<CK2Title*> overlapping;
+        for (auto* ck2prov : eu4prov->ckProvs()) {
+          CK2Title* countyTitle = ck2prov->getCountyTitle();
+          if (!countyTitle) continue;
+          CK2Title* kingdom = countyTitle->getDeJureLevel(TitleLevel::Kingdom);
+          if (kingdom) overlapping.insert(kingdom);
+        }
+        for (auto* kingdom : overlapping) {
+          candidates[kingdom].push_back(eu4prov);
+        }
+      }
+    }
     while (vassalPercentage < minBalkan) {
-      if (ownerMap[overlord] <= balkanThreshold) {
+      if (bloc.provinces(overlord) <= balkanThreshold) {
         Logger::logStream("countries")
-            << ownerMap[overlord] << " provinces are too few to balkanise.\n";
+            << bloc.provinces(overlord) << " provinces are too few to balkanise.\n";
         break;
       }
       if (!printed) {
@@ -1826,13 +3353,8 @@ bool Converter::adjustBalkanisation () {
       set<EU4Country*> attempted;
       bool success = false;
       while (attempted.size() < lord.second.size()) {
-	EU4Country* target = lord.second[0];
-	for (auto* subject : lord.second) {
-	  if (attempted.count(subject)) continue;
-	  if (ownerMap[subject] >= ownerMap[target]) continue;
-	  target = subject;
-	}
-	if (attempted.count(target)) {
+	EU4Country* target = bloc.smallestSubject(attempted, false);
+	if (!target) {
 	  Logger::logStream("countries") << "Could not find good target for balkanisation.\n";
 	  break;
 	}
@@ -1858,28 +3380,21 @@ bool Converter::adjustBalkanisation () {
 	}
 	sort(targetKingdoms.begin(), targetKingdoms.end(), ObjectDescendingSorter("vassal_provinces"));
 	for (auto* kingdom : targetKingdoms) {
-	  for (auto* eu4prov : overlord->getProvinces()) {
-	    bool acceptable = false;
-	    for (auto* ck2prov : eu4prov->ckProvs()) {
-	      CK2Title* countyTitle = ck2prov->getCountyTitle();
-	      if (!countyTitle) continue;
-	      CK2Title* curr = countyTitle->getDeJureLevel(TitleLevel::Kingdom);
-	      if (curr != kingdom) continue;
-	      acceptable = true;
-	      break;
-	    }
-	    if (!acceptable) continue;
-	    Logger::logStream("countries") << "Reassigned " << eu4prov->getName() << " to "
-					   << target->getKey() << "\n";
-	    eu4prov->assignCountry(target);
-	    target->setAsCore(eu4prov);
-	    overlord->removeCore(eu4prov);
-	    ownerMap[target]++;
-	    ownerMap[overlord]--;
-	    success = true;
-	    break;
+	  const vector<EU4Province*>& inKingdom = candidates[kingdom];
+	  unsigned int& next = nextCandidate[kingdom];
+	  while (next < inKingdom.size() && inKingdom[next]->getEU4Country() != overlord) {
+	    ++next;
 	  }
-	  if (success) break;
+	  if (next >= inKingdom.size()) continue;
+	  EU4Province* eu4prov = inKingdom[next];
+	  Logger::logStream("countries") << "Reassigned " << eu4prov->getName() << " to "
+					 << target->getKey() << "\n";
+	  eu4prov->assignCountry(target);
+	  target->setAsCore(eu4prov);
+	  overlord->removeCore(eu4prov);
+	  bloc.transfer(overlord, target);
+	  success = true;
+	  break;
 	}
 	if (success) break;
       }
@@ -1888,7 +3403,7 @@ bool Converter::adjustBalkanisation () {
 	Logger::logStream("countries") << "Giving up on balkanising " << overlord->getKey() << "\n";
 	break;
       }      
-      vassalPercentage = getVassalPercentage(lord, ownerMap);
+      vassalPercentage = bloc.vassalPercentage();
     }
 
     while (vassalPercentage > maxBalkan) {
@@ -1905,19 +3420,9 @@ bool Converter::adjustBalkanisation () {
       bool success = false;
 
       while (attempted.size() < lord.second.size()) {
-	EU4Country* target = lord.second[0];
-	for (auto* subject : lord.second) {
-	  if (attempted.count(subject)) continue;
-	  if (0 == ownerMap[subject]) {
-	    attempted.insert(subject);
-	    continue;
-	  }
-	  if ((ownerMap[target] > 0) && (ownerMap[subject] >= ownerMap[target])) continue;
-	  target = subject;
-	}
-	if (attempted.count(target)) break;
+	EU4Country* target = bloc.smallestSubject(attempted, true);
+	if (!target) break;
 	attempted.insert(target);
-	if (0 == ownerMap[target]) continue;
 	EU4Province::Iter iter = target->startProvince();
 	EU4Province* province = *iter;
         if (!province) {
@@ -1939,9 +3444,8 @@ bool Converter::adjustBalkanisation () {
 	overlord->setAsCore(province);
 	target->removeCore(province);
 
-	ownerMap[overlord]++;
-	ownerMap[target]--;
-        if (ownerMap[target] == 0) {
+	bloc.transfer(target, overlord);
+        if (bloc.provinces(target) == 0) {
           independenceRevolts.insert(target);
         }
 	success = true;
@@ -1952,7 +3456,7 @@ bool Converter::adjustBalkanisation () {
 	Logger::logStream("countries") << "Giving up on reblobbing " << overlord->getKey() << "\n";
 	break;
       }
-      vassalPercentage = getVassalPercentage(lord, ownerMap);
+      vassalPercentage = bloc.vassalPercentage();
     }
     if (dent) {
       Logger::logStream("countries")
@@ -2312,7 +3816,8 @@ void Converter::calculateDynasticScores() {
   Logger::logStream("characters") << "Starting character iteration.\n";
   unordered_map<string, Object*> characters;
   Object* score_traits = customObject->getNeededObject("custom_score_traits");
-  for (auto* character : ck2Game->getNeededObject("character")->getLeaves()) {
+  for (const auto& scored : scoredCharacters) {
+    Object* character = scored.second;
     string dIndex = character->safeGetString(dynastyString, PlainNone);
     if (dIndex == PlainNone || dynastyScores.find(dIndex) == dynastyScores.end()) {
       continue;
@@ -2345,7 +3850,11 @@ void Converter::calculateDynasticScores() {
         << "Problem with start date: \"" << startDate << "\".\n";
   }
 
+  setStageItems(CK2Title::totalAmount());
   for (auto* title : CK2Title::getAll()) {
+    if (cancelled()) return;
+    advanceStage();
+    AllocationSite site("title histories");
     if (title->safeGetString("landless") == "yes") {
       continue;
     }
@@ -2420,12 +3929,19 @@ double getTotalWeight(Object* building, Object* weights) {
   return weight;
 }
 
-void calculateBuildingWeights(objvec& buildingTypes, Object* weights) {
+void calculateBuildingWeights(objvec& buildingTypes, Object* weights,
+                              vector<BuildingWeights>& table) {
   if (10 > buildingTypes.size()) {
     Logger::logStream(LogStream::Warn)
         << "Only found " << buildingTypes.size()
         << " types of buildings. Proceeding, but dubiously.\n";
   }
+  table.clear();
+  for (auto* bt : buildingTypes) {
+    table.push_back({bt, bt->getKey(),
+                     vector<double>(ProvinceWeight::numTypes(), 0),
+                     vector<double>(ProvinceWeight::numTypes(), 0)});
+  }
   for (auto p = ProvinceWeight::start(); p != ProvinceWeight::final(); ++p) {
     std::string areaName = (*p)->getName();
     Object* currWeights = weights->safeGetObject(areaName);
@@ -2443,13 +3959,13 @@ void calculateBuildingWeights(objvec& buildingTypes, Object* weights) {
           << " modifiers in CK building weights, Bad Things will happen.\n";
     }
     Object* mult = currWeights = currWeights->getNeededObject("mult");
-    for (auto* bt : buildingTypes) {
-      double weight = getTotalWeight(bt, linear);
-      bt->setLeaf(areaName, weight);
-      double totalMult = getTotalWeight(bt, mult);
-      bt->setLeaf(areaName + "_mult", totalMult);
+    for (auto& entry : table) {
+      double weight = getTotalWeight(entry.building, linear);
+      entry.weights[**p] = weight;
+      double totalMult = getTotalWeight(entry.building, mult);
+      entry.mults[**p] = totalMult;
       Logger::logStream("buildings")
-          << "Set " << areaName << " of " << bt->getKey() << " to " << weight
+          << "Set " << areaName << " of " << entry.key << " to " << weight
           << " and " << totalMult << "\n";
     }
   }
@@ -2511,13 +4027,14 @@ bool Converter::calculateProvinceWeights () {
   }
 
   objvec buildingTypes = ckBuildingObject->getLeaves();
-  calculateBuildingWeights(buildingTypes, ckBuildingWeights);
+  vector<BuildingWeights> buildingWeights;
+  calculateBuildingWeights(buildingTypes, ckBuildingWeights, buildingWeights);
 
   Object* minWeights = configObject->getNeededObject("minimumWeights");
   minWeights->setValue(customObject->getNeededObject("special_nerfs"));
   minWeights->setValue(customObject->getNeededObject("government_weights"));
   for (auto* ck2prov : CK2Province::getAll()) {
-    ck2prov->calculateWeights(minWeights, buildingTypes);
+    ck2prov->calculateWeights(minWeights, buildingWeights);
     Logger::logStream("provinces") << nameAndNumber(ck2prov)
 				   << " has weights production "
 				   << ck2prov->getWeight(ProvinceWeight::Production)
@@ -2565,16 +4082,16 @@ void cleanStates(Object* map_area_data) {
       continue;
     }
     objvec country_states = state->getValue("country_state");
-    objvec to_remove;
+    unordered_set<Object*> to_remove;
     for (auto* cs : country_states) {
       std::string tag = remQuotes(cs->safeGetString("country", QuotedNone));
       EU4Country* country = EU4Country::findByName(tag);
       if (country->converts()) {
-        to_remove.push_back(cs);
+        to_remove.insert(cs);
       }
     }
+    removeChildren(state, to_remove);
     for (auto* tr : to_remove) {
-      state->removeObject(tr);
       delete tr;
     }
   }
@@ -2598,7 +4115,20 @@ bool Converter::cleanEU4Nations () {
   Object* default_missions = configObject->getNeededObject("default_missions");
   Object* custom_ideas = customObject->getNeededObject("custom_ideas");
   Object* custom_colors = customObject->getNeededObject("custom_colors");
-  vector<string> tags_to_clean;
+  unordered_set<string> keysToUnset;
+  for (int i = 0; i < keysToRemove->numTokens(); ++i) {
+    keysToUnset.insert(keysToRemove->getToken(i));
+  }
+  unordered_set<string> zeroProvKeysToUnset;
+  for (int i = 0; i < zeroProvKeys->numTokens(); ++i) {
+    zeroProvKeysToUnset.insert(zeroProvKeys->getToken(i));
+  }
+  unordered_set<string> tags_to_clean;
+  unordered_set<Object*> dipsToRemove;
+  // Nothing is removed until after the loop, so one snapshot of each
+  // list serves every country.
+  objvec dipObjects = diplomacy->getLeaves();
+  objvec missionLeaves = default_missions->getLeaves();
   for (EU4Country::Iter eu4country = EU4Country::start(); eu4country != EU4Country::final(); ++eu4country) {
     if (!(*eu4country)->converts()) continue;
     string eu4tag = (*eu4country)->getKey();
@@ -2606,9 +4136,7 @@ bool Converter::cleanEU4Nations () {
       Object* toClear = (*eu4country)->getNeededObject(keysToClear->getToken(i));
       toClear->clear();
     }
-    for (int i = 0; i < keysToRemove->numTokens(); ++i) {
-      (*eu4country)->unsetValue(keysToRemove->getToken(i));
-    }
+    unsetValues((*eu4country)->object, keysToUnset);
 
     auto* colors = custom_colors->safeGetObject(eu4tag);
     if (colors != nullptr && colors->numTokens() > 2) {
@@ -2630,7 +4158,7 @@ bool Converter::cleanEU4Nations () {
     }
 
     Object* missions = (*eu4country)->getNeededObject("country_missions");
-    missions->setValue(default_missions->getLeaves());
+    missions->setValue(missionLeaves);
     string ideas = custom_ideas->safeGetString(eu4tag, PlainNone);
     if (ideas != PlainNone) {
       auto* ideaObject = (*eu4country)->getNeededObject("active_idea_groups");
@@ -2642,31 +4170,27 @@ bool Converter::cleanEU4Nations () {
     if (0 < ownerMap[*eu4country]) continue;
     Logger::logStream("countries")
         << eu4tag << " has no provinces, removing diplomacy.\n";
-    tags_to_clean.push_back(eu4tag);
+    tags_to_clean.insert(eu4tag);
     (*eu4country)->resetLeaf(EU4Country::kNoProvinceMarker, "yes");
     active_advisors->unsetValue(eu4tag);
-    for (int i = 0; i < zeroProvKeys->numTokens(); ++i) {
-      (*eu4country)->unsetValue(zeroProvKeys->getToken(i));
-    }
+    unsetValues((*eu4country)->object, zeroProvKeysToUnset);
 
-    objvec dipsToRemove;
-    objvec dipObjects = diplomacy->getLeaves();
+    // Removed in one pass after the loop; skip those already marked.
     for (objiter dip = dipObjects.begin(); dip != dipObjects.end(); ++dip) {
+      if (dipsToRemove.count(*dip)) continue;
       string first = remQuotes((*dip)->safeGetString("first"));
       string second = (*dip)->safeGetString("second");
       if ((first != eu4tag) && (remQuotes(second) != eu4tag)) continue;
       Logger::logStream(LogStream::Info)
           << "Removing " << (*dip) << " due to " << first << ", "
           << remQuotes(second) << " and " << eu4tag << " has no provinces\n";
-      dipsToRemove.push_back(*dip);
+      dipsToRemove.insert(*dip);
       EU4Country* overlord = EU4Country::getByName(first);
       overlord->getNeededObject("friends")->remToken(second);
       overlord->getNeededObject("subjects")->remToken(second);
     }
-    for (objiter rem = dipsToRemove.begin(); rem != dipsToRemove.end(); ++rem) {
-      diplomacy->removeObject(*rem);
-    }
   }
+  removeChildren(diplomacy, dipsToRemove);
 
   for (auto* eu4prov : EU4Province::getAll()) {
     if (!eu4prov->converts()) continue;
@@ -2685,14 +4209,11 @@ bool Converter::cleanEU4Nations () {
 
   Object* trade = eu4Game->getNeededObject("trade");
   objvec nodes = trade->getValue("node");
+  unordered_set<string> nodeKeys(tags_to_clean);
+  nodeKeys.insert({"top_provinces", "top_provinces_values", "top_power",
+                   "top_power_values"});
   for (auto* node : nodes) {
-    for (const auto& tag : tags_to_clean) {
-      node->unsetValue(tag);
-    }
-    node->unsetValue("top_provinces");
-    node->unsetValue("top_provinces_values");
-    node->unsetValue("top_power");
-    node->unsetValue("top_power_values");
+    unsetValues(node, nodeKeys);
   }
   for (EU4Country::Iter eu4country = EU4Country::start();
        eu4country != EU4Country::final(); ++eu4country) {
@@ -2700,9 +4221,7 @@ bool Converter::cleanEU4Nations () {
     if (!relations) {
       continue;
     }
-    for (const auto& tag : tags_to_clean) {
-      relations->unsetValue(tag);
-    }
+    unsetValues(relations, tags_to_clean);
   }
 
   // Ensure that nations such as Portugal which own both converting and
@@ -2812,6 +4331,25 @@ bool Converter::createArmies () {
   double totalCkTroops = 0;
   int countries = 0;
 
+  // A CK2 province feeds every EU4 province it maps to, so scan its
+  // baronies for levies once rather than once per EU4 province.
+  unordered_map<CK2Province*, vector<pair<CK2Title*, Object*>>> leviesCache;
+  auto baronyLevies = [&leviesCache](CK2Province* ck2prov)
+      -> const vector<pair<CK2Title*, Object*>>& {
+    auto cached = leviesCache.find(ck2prov);
+    if (cached != leviesCache.end()) return cached->second;
+    auto& levies = leviesCache[ck2prov];
+    for (auto* leaf : ck2prov->getLeaves()) {
+      Object* levy = leaf->safeGetObject("levy");
+      if (!levy) continue;
+      if (leaf->getKey() == tradePostString) continue;
+      CK2Title* baronyTitle = CK2Title::findByName(leaf->getKey());
+      if (!baronyTitle) continue;
+      levies.emplace_back(baronyTitle, levy);
+    }
+    return levies;
+  };
+
   for (auto* eu4country : EU4Country::getAll()) {
     if (!eu4country) {
       Logger::logStream(LogStream::Error) << "Null EU4 country?!\n";
@@ -2845,14 +4383,10 @@ bool Converter::createArmies () {
       double weighted = 0;
       for (CK2Province::Iter ck2prov = eu4prov->startProv(); ck2prov != eu4prov->finalProv(); ++ck2prov) {
 	double weightFactor = 1.0 / (*ck2prov)->numEU4Provinces();
-	objvec leaves = (*ck2prov)->getLeaves();
-	for (objiter leaf = leaves.begin(); leaf != leaves.end(); ++leaf) {
-	  Object* levy = (*leaf)->safeGetObject("levy");
-	  if (!levy) continue;
-	  string baronyTag = (*leaf)->getKey();
-	  if (baronyTag == tradePostString) continue;
-	  CK2Title* baronyTitle = CK2Title::findByName(baronyTag);
-	  if (!baronyTitle) continue;
+	for (const auto& barony : baronyLevies(*ck2prov)) {
+	  Object* levy = barony.second;
+	  CK2Title* baronyTitle = barony.first;
+	  string baronyTag = baronyTitle->getKey();
 	  CK2Ruler* sovereign = baronyTitle->getSovereign();
 	  Logger::logStream("armies") << baronyTag << ": ";
           if (sovereign != eu4country->getRuler()) {
@@ -2934,7 +4468,7 @@ bool Converter::createArmies () {
 			      << numRegiments
 			      << ".\n";
 
-  configObject->setLeaf("regimentsPerTroop", numRegiments / totalCkTroops);
+  configObject->resetLeaf("regimentsPerTroop", numRegiments / totalCkTroops);
   string infantryType = configObject->safeGetString("infantry_type", "\"western_medieval_infantry\"");
   string cavalryType = configObject->safeGetString("cavalry_type", "\"western_medieval_knights\"");
   int infantryRegiments = configObject->safeGetInt("infantry_per_cavalry", 7);
@@ -3732,62 +5266,136 @@ bool heuristicNameMatch (const string& one, const string& two) {
   return overlap > 0.8;
 }
 
-pair<string, string> findBest (map<string, map<string, int> >& corrMap) {
-  pair<string, string> ret(PlainNone, PlainNone);
-  int highest = 0;
-  for (map<string, map<string, int> >::iterator corr = corrMap.begin(); corr != corrMap.end(); ++corr) {
-    for (map<string, int>::iterator curr = corr->second.begin(); curr != corr->second.end(); ++curr) {
-      if (heuristicNameMatch(curr->first, corr->first)) {
-	Logger::logStream("cultures") << "Assigning "
-				      << corr->first << " to "
-				      << curr->first << " based on similar names.\n";
-	return pair<string, string>(corr->first, curr->first);
-      }
-      if (curr->second <= highest) continue;
-      highest    = curr->second;
-      ret.first  = corr->first;
-      ret.second = curr->first;
-    }
-  }
-
-  Logger::logStream("cultures") << "Assigning " << ret.first << " to "
-				<< ret.second << " based on overlap " << highest << " ";
-
-  return ret;
-}
+// Correspondence counts between CK and EU names as a dense matrix, with
+// rows and columns in name order. Each row's first name match and its
+// largest overlap are found once, up front; rows are then handed out in
+// the order a full rescan would pick them: the first remaining row with a
+// similar name, else the largest overlap, earlier rows and columns winning
+// ties.
+class CorrespondenceMatrix {
+public:
+  CorrespondenceMatrix (const map<string, map<string, int> >& corrMap) {
+    set<string> names;
+    for (const auto& row : corrMap) {
+      rowNames.push_back(row.first);
+      for (const auto& cell : row.second) names.insert(cell.first);
+    }
+    columnNames.assign(names.begin(), names.end());
+    unordered_map<string, int> columnIndex;
+    for (unsigned int col = 0; col < columnNames.size(); ++col) {
+      columnIndex[columnNames[col]] = col;
+    }
+    counts.assign(rowNames.size() * columnNames.size(), 0);
+    support.assign(columnNames.size(), 0);
+    int row = 0;
+    for (const auto& entries : corrMap) {
+      for (const auto& cell : entries.second) {
+        int col = columnIndex[cell.first];
+        counts[row * columnNames.size() + col] = cell.second;
+        support[col]++;
+      }
+      ++row;
+    }
+
+    nameMatch.assign(rowNames.size(), -1);
+    bestColumn.assign(rowNames.size(), -1);
+    for (row = 0; row < (int) rowNames.size(); ++row) {
+      int highest = 0;
+      for (int col = 0; col < (int) columnNames.size(); ++col) {
+        int count = get(row, col);
+        if (0 == count) continue;
+        if (heuristicNameMatch(columnNames[col], rowNames[row])) {
+          nameMatch[row] = col;
+          matched.insert(row);
+          break;
+        }
+        if (count <= highest) continue;
+        highest = count;
+        bestColumn[row] = col;
+      }
+      if (bestColumn[row] >= 0) byOverlap.push(make_pair(highest, -row));
+    }
+  }
+
+  // Picks and removes the next row, logging why; -1 once none is left.
+  int takeBest (int* column) {
+    if (!matched.empty()) {
+      int row = *matched.begin();
+      remove(row);
+      *column = nameMatch[row];
+      Logger::logStream("cultures") << "Assigning "
+				    << rowNames[row] << " to "
+				    << columnNames[*column] << " based on similar names.\n";
+      return row;
+    }
+    while (!byOverlap.empty() && removed.count(-byOverlap.top().second)) {
+      byOverlap.pop();
+    }
+    if (byOverlap.empty()) {
+      Logger::logStream("cultures") << "Assigning " << PlainNone << " to "
+				    << PlainNone << " based on overlap 0 ";
+      return -1;
+    }
+    int row = -byOverlap.top().second;
+    remove(row);
+    *column = bestColumn[row];
+    Logger::logStream("cultures") << "Assigning " << rowNames[row] << " to "
+				  << columnNames[*column] << " based on overlap "
+				  << get(row, *column) << " ";
+    return row;
+  }
+
+  int get (int row, int col) const {return counts[row * columnNames.size() + col];}
+  int numColumns () const {return columnNames.size();}
+  int rowsWith (int col) const {return support[col];}
+  const string& rowName (int row) const {return rowNames[row];}
+  const string& columnName (int col) const {return columnNames[col];}
+
+private:
+  void remove (int row) {
+    removed.insert(row);
+    matched.erase(row);
+  }
+
+  vector<string> rowNames;
+  vector<string> columnNames;
+  vector<int> counts;
+  vector<int> support;    // Rows with a non-zero count, per column.
+  vector<int> nameMatch;  // First similarly named column, per row.
+  vector<int> bestColumn; // Largest overlap, per row.
+  set<int> matched;
+  set<int> removed;
+  priority_queue<pair<int, int> > byOverlap; // Overlap, then minus the row.
+};
 
 void makeMap(map<string, map<string, int>>& cultures,
              map<string, vector<string>>& assigns, double splitCutoff = 2, Object* storage = 0) {
-  map<string, map<string, int> > reverseMap;
-  for (map<string, map<string, int> >::iterator cult = cultures.begin(); cult != cultures.end(); ++cult) {
-    for (map<string, int>::iterator look = cult->second.begin(); look != cult->second.end(); ++look) {
-      reverseMap[look->first][cult->first] += look->second;
-    }
-  }
-
+  CorrespondenceMatrix matrix(cultures);
   while (!cultures.empty()) {
-    pair<string, string> best = findBest(cultures);
-    string ckCulture = best.first;
-    if (ckCulture == PlainNone) break;
-    if (storage) storage->setLeaf(best.first, best.second);
-    string euCulture = best.second;
+    int euIndex = -1;
+    int ckIndex = matrix.takeBest(&euIndex);
+    if (ckIndex < 0) break;
+    string ckCulture = matrix.rowName(ckIndex);
+    string euCulture = matrix.columnName(euIndex);
+    if (storage) storage->setLeaf(ckCulture, euCulture);
     assigns[ckCulture].push_back(euCulture);
-    double highestValue = cultures[ckCulture][euCulture];
-    
-    for (map<string, int>::iterator cand = cultures[ckCulture].begin(); cand != cultures[ckCulture].end(); ++cand) {
-      if (cand->first == euCulture) continue;
-      Logger::logStream("cultures") << "(" << cand->first << " " << cand->second << " ";
-      if (cand->second < highestValue * splitCutoff) {
+    double highestValue = matrix.get(ckIndex, euIndex);
+
+    for (int cand = 0; cand < matrix.numColumns(); ++cand) {
+      int count = matrix.get(ckIndex, cand);
+      if (0 == count || cand == euIndex) continue;
+      Logger::logStream("cultures") << "(" << matrix.columnName(cand) << " " << count << " ";
+      if (count < highestValue * splitCutoff) {
 	Logger::logStream("cultures") << ") ";
         continue;
       }
-      if (1 == reverseMap[cand->first].size()) {
+      if (1 == matrix.rowsWith(cand)) {
 	Logger::logStream("cultures") << "[sole]) ";
       }
       else {
-	Logger::logStream("cultures") << "[" << cand->second / highestValue << "]) ";
+	Logger::logStream("cultures") << "[" << count / highestValue << "]) ";
       }
-      assigns[ckCulture].push_back(cand->first);
+      assigns[ckCulture].push_back(matrix.columnName(cand));
     }
     Logger::logStream("cultures") << "\n";
     cultures.erase(ckCulture);
@@ -4004,24 +5612,10 @@ bool Converter::cultureAndReligion () {
 }
 
 Object* Converter::createTypedId (string keyword, string idType) {
-  static const std::unordered_map<string, unsigned int> keyword_map = {
-      {"monarch", 1}, {"leader", 2}, {"advisor", 3}, {"rebel", 4}};
-
-  int number = -1;
-  Object* counters = eu4Game->safeGetObject("id_counters");
-  if (counters != nullptr) {
-    auto entry = keyword_map.find(keyword);
-    if (entry != keyword_map.end()) {
-      unsigned int index = entry->second;
-      number = counters->tokenAsInt(index);
-      sprintf(strbuffer, "%i", number + 1);
-      counters->resetToken(index, strbuffer);
-    }
-  }
-  if (number == -1) {
-    number = eu4Game->safeGetInt(keyword, 1);
-    eu4Game->resetLeaf(keyword, number + 1);
+  if (!idAllocator.isLoaded()) {
+    idAllocator.load(eu4Game);
   }
+  int number = idAllocator.next(keyword);
 
   Object* unitId = new Object("id");
   unitId->setLeaf("id", number);
@@ -5217,7 +6811,13 @@ bool Converter::setCores () {
   Logger::logStream(LogStream::Info) << "Beginning cores and claims.\n" << LogOption::Indent;
 
   map<EU4Province*, map<EU4Country*, int> > claimsMap;
+  setStageItems(CK2Province::totalAmount());
   for (CK2Province::Iter ck2prov = CK2Province::start(); ck2prov != CK2Province::final(); ++ck2prov) {
+    if (cancelled()) {
+      Logger::logStream(LogStream::Info) << "Cancelled.\n" << LogOption::Undent;
+      return false;
+    }
+    advanceStage();
     Logger::logStream("cores") << "Seeking core for "
 			       << nameAndNumber(*ck2prov)
 			       << ".\n"
@@ -5433,7 +7033,13 @@ bool Converter::transferProvinces () {
 
   bool debugNames = (configObject->safeGetString("debug_names", "no") == "yes");
   std::unordered_set<EU4Province*> deferred;
+  setStageItems(EU4Province::totalAmount());
   for (auto* eu4prov : EU4Province::getAll()) {
+    if (cancelled()) {
+      Logger::logStream(LogStream::Info) << "Cancelled.\n" << LogOption::Undent;
+      return false;
+    }
+    advanceStage();
     if (0 == eu4prov->numCKProvinces()) continue; // ROTW or water.
     map<EU4Country*, double> weights;
     double rebelWeight = 0;
@@ -5600,18 +7206,14 @@ bool Converter::warsAndRebels () {
 
   Logger::logStream(LogStream::Info) << "Beginning wars.\n" << LogOption::Indent;
   objvec euWars = eu4Game->getValue("active_war");
+  unordered_set<Object*> warsToRemove;
   for (objiter euWar = euWars.begin(); euWar != euWars.end(); ++euWar) {
     vector<string> convertingTags;
-    objvec attackers = (*euWar)->getValue("attacker");
-    for (objiter attacker = attackers.begin(); attacker != attackers.end(); ++attacker) {
-      string tag = remQuotes((*attacker)->getLeaf());
-      EU4Country* eu4country = EU4Country::findByName(tag);
-      if (!eu4country->converts()) continue;
-      convertingTags.push_back(tag);
-    }
-    objvec defenders = (*euWar)->getValue("defender");
-    for (objiter defender = defenders.begin(); defender != defenders.end(); ++defender) {
-      string tag = remQuotes((*defender)->getLeaf());
+    // One pass over the war picks up both sides.
+    for (auto* participant : (*euWar)->getLeaves()) {
+      const string side = participant->getKey();
+      if ((side != "attacker") && (side != "defender")) continue;
+      string tag = remQuotes(participant->getLeaf());
       EU4Country* eu4country = EU4Country::findByName(tag);
       if (!eu4country->converts()) continue;
       convertingTags.push_back(tag);
@@ -5624,8 +7226,9 @@ bool Converter::warsAndRebels () {
       Logger::logStream("war") << (*tag) << " ";
     }
     Logger::logStream("war") << "\n";
-    eu4Game->removeObject(*euWar);
+    warsToRemove.insert(*euWar);
   }
+  removeChildren(eu4Game, warsToRemove);
 
   bool addParticipants = false;
   bool joined_war = true;
@@ -5825,6 +7428,7 @@ bool Converter::warsAndRebels () {
   objvec factions = eu4Game->getValue("rebel_faction");
   objvec rebel_leaders = rebelCountry->getValue("leader");
   objvec rebel_armies = rebelCountry->getValue("army");
+  unordered_set<Object*> factionsToRemove;
   for (auto* faction : factions) {
     EU4Country* country = EU4Country::findByName(
         remQuotes(faction->safeGetString("country", QuotedNone)));
@@ -5858,13 +7462,16 @@ bool Converter::warsAndRebels () {
         province->removeObject(rebel_id);
       }
     }
-    eu4Game->removeObject(faction);
+    factionsToRemove.insert(faction);
   }
+  removeChildren(eu4Game, factionsToRemove);
 
   Object* cbConversion = configObject->getNeededObject("rebel_faction_types");
   before = eu4Game->safeGetObject("religions");
   string activationDate = eu4Game->safeGetString("date", "1444.11.11");
   objvec generalSkills = configObject->getNeededObject("generalSkills")->getLeaves();
+  double regimentsPerTroop = configObject->safeGetFloat("regimentsPerTroop");
+  string infantryType = configObject->safeGetString("infantry_type", "\"western_medieval_infantry\"");
 
   for (auto* cand : rebelCandidates) {
     string ckCasusBelli =
@@ -6020,7 +7627,7 @@ bool Converter::warsAndRebels () {
     }
     army->setLeaf("location", rebelLocation);
     int rebelRegiments = (int)floor(
-        rebelTroops * configObject->safeGetFloat("regimentsPerTroop") + 0.5);
+        rebelTroops * regimentsPerTroop + 0.5);
     if (rebelRegiments < 3) {
       rebelRegiments = 3;
     }
@@ -6033,7 +7640,7 @@ bool Converter::warsAndRebels () {
       regiment->setValue(createUnitId("50"));
       regiment->setLeaf("name", "\"Rebel Regiment\"");
       regiment->setLeaf("home", rebelLocation);
-      regiment->setLeaf("type", configObject->safeGetString("infantry_type", "\"western_medieval_infantry\""));
+      regiment->setLeaf("type", infantryType);
       regiment->setLeaf("morale", "2.000");
       regiment->setLeaf("strength", "1.000");
     }
@@ -6222,72 +7829,137 @@ void Converter::convert () {
     Logger::logStream(LogStream::Info) << "No file loaded.\n";
     return; 
   }
+  restoreLoadedState();
 
+  Object* profileConfig = configObject->safeGetObject("allocation_profile");
+  if (profileConfig && profileConfig->safeGetString("active", "no") == "yes") {
+    if (AllocationProfile::available()) {
+      AllocationProfile::start();
+      AllocationProfile::beginStage("loadFiles");
+    } else {
+      Logger::logStream(LogStream::Warn)
+          << "This build cannot profile allocations, see ALLOCATION_PROFILE.\n";
+    }
+  }
   loadFiles();
   // Last leaf needs special treatment.
   objvec leaves = eu4Game->getLeaves();
   Object* final = leaves.back();
   eu4Game->removeObject(final);
-  ofstream* debug = Logger::getLogFile();
 
-  if (debug) (*debug) << "createCK2Objects" << std::endl;
-  if (!createCK2Objects()) return;
-  if (debug) (*debug) << "createEU4Objects" << std::endl;
-  if (!createEU4Objects()) return;
-  if (debug) (*debug) << "createProvinceMap" << std::endl;
-  if (!createProvinceMap()) return;
-  if (debug) (*debug) << "createCountryMap" << std::endl;
-  if (!createCountryMap()) return;
-  if (debug) (*debug) << "resetHistories" << std::endl;
-  if (!resetHistories()) return;
-  if (debug) (*debug) << "calculateProvinceWeights" << std::endl;
-  if (!calculateProvinceWeights()) return;
-  if (debug) (*debug) << "transferProvinces" << std::endl;
-  if (!transferProvinces()) return;
-  if (debug) (*debug) << "setCores" << std::endl;
-  if (!setCores()) return;
-  if (debug) (*debug) << "moveCapitals" << std::endl;
-  if (!moveCapitals()) return;
-  if (debug) (*debug) << "modifyProvinces" << std::endl;
-  if (!modifyProvinces()) return;
-  if (debug) (*debug) << "setupDiplomacy" << std::endl;
-  if (!setupDiplomacy()) return;
-  if (debug) (*debug) << "adjustBalkanisation" << std::endl;
-  if (!adjustBalkanisation()) return;
-  if (debug) (*debug) << "moveBuildings" << std::endl;
-  if (!moveBuildings()) return;
-  if (debug) (*debug) << "cleanEU4Nations" << std::endl;
-  if (!cleanEU4Nations()) return;
-  if (debug) (*debug) << "createArmies" << std::endl;
-  if (!createArmies()) return;
-  if (debug) (*debug) << "createNavies" << std::endl;
-  if (!createNavies()) return;
-  if (debug) (*debug) << "cultureAndReligion" << std::endl;
-  if (!cultureAndReligion()) return;
-  if (debug) (*debug) << "createGovernments" << std::endl;
-  if (!createGovernments()) return;
-  if (debug) (*debug) << "createCharacters" << std::endl;
-  if (!createCharacters()) return;
-  if (debug) (*debug) << "redistributeMana" << std::endl;
-  if (!redistributeMana()) return;
-  if (debug) (*debug) << "hreAndPapacy" << std::endl;
-  if (!hreAndPapacy()) return;
-  if (debug) (*debug) << "warsAndRebels" << std::endl;
-  if (!warsAndRebels()) return;
-  if (debug) (*debug) << "Great Works" << std::endl;
-  if (!greatWorks()) return;
-  if (debug) (*debug) << "Estates" << std::endl;
-  if (!estates()) return;
-  if (debug) (*debug) << "displayStats" << std::endl;
-  displayStats();
+  typedef bool (Converter::*Stage)();
+  static const vector<pair<string, Stage> > stages = {
+      {"createCK2Objects", &Converter::createCK2Objects},
+      {"createEU4Objects", &Converter::createEU4Objects},
+      {"createProvinceMap", &Converter::createProvinceMap},
+      {"pruneCK2Game", &Converter::pruneCK2Game},
+      // Stages not in replayedStages are skipped when resuming. Next to
+      // each is what it leaves for later stages outside eu4Game, and where
+      // the checkpoint keeps it; the others change only eu4Game.
+      // Ruler and title links of countries: "countries".
+      {"createCountryMap", &Converter::createCountryMap},
+      {"resetHistories", &Converter::resetHistories},
+      {"calculateProvinceWeights", &Converter::calculateProvinceWeights},
+      // Province to country links: "countries".
+      {"transferProvinces", &Converter::transferProvinces},
+      {"setCores", &Converter::setCores},
+      {"moveCapitals", &Converter::moveCapitals},
+      {"modifyProvinces", &Converter::modifyProvinces},
+      {"setupDiplomacy", &Converter::setupDiplomacy},
+      // Province to country links: "countries". Independence revolts:
+      // "revolts". CK title vassal_provinces is read only here.
+      {"adjustBalkanisation", &Converter::adjustBalkanisation},
+      {"moveBuildings", &Converter::moveBuildings},
+      {"cleanEU4Nations", &Converter::cleanEU4Nations},
+      // regimentsPerTroop: kStageConfigOutputs. CK ruler retinueWeight is
+      // read only here.
+      {"createArmies", &Converter::createArmies},
+      // CK ruler shipWeight is read only here.
+      {"createNavies", &Converter::createNavies},
+      // Culture and religion maps: "cultures", "religions".
+      // dynamicReligions: kStageConfigOutputs.
+      {"cultureAndReligion", &Converter::cultureAndReligion},
+      {"createGovernments", &Converter::createGovernments},
+      // CK ruler madeCharacters is read only here.
+      {"createCharacters", &Converter::createCharacters},
+      // CK province autonomy and ruler tech_value are read only here.
+      {"redistributeMana", &Converter::redistributeMana},
+      {"hreAndPapacy", &Converter::hreAndPapacy},
+      {"warsAndRebels", &Converter::warsAndRebels},
+      {"greatWorks", &Converter::greatWorks},
+      {"estates", &Converter::estates},
+      {"displayStats", &Converter::displayStats},
+  };
+  vector<string> stageNames;
+  for (const auto& stage : stages) {
+    stageNames.push_back(stage.first);
+  }
+
+  // Stages rebuilding wrappers from the CK save and map files; these are
+  // rerun when resuming from a checkpoint, the others are skipped.
+  static const unordered_set<string> replayedStages = {
+      "createCK2Objects", "createEU4Objects", "createProvinceMap",
+      "pruneCK2Game", "calculateProvinceWeights"};
+  set<string> checkpointStages;
+  string resumeStage;
+  Object* checkpointConfig = configObject->safeGetObject("checkpoints");
+  if (checkpointConfig) {
+    Object* after = checkpointConfig->getNeededObject("after");
+    for (int i = 0; i < after->numTokens(); ++i) {
+      checkpointStages.insert(after->getToken(i));
+    }
+    bool resume = (checkpointConfig->safeGetString("resume", "no") == "yes");
+    if (resume || !checkpointStages.empty()) {
+      fingerprintStages(stageNames);
+    }
+    if (resume) {
+      resumeStage = loadCheckpoint(stageNames);
+    }
+  }
+  idAllocator.load(eu4Game);
+
+  stageNames.push_back("calculateDynasticScores");
+  stageNames.push_back("cleanUp");
+  stageNames.push_back("exportWorld");
+  startProgress("convert", stageNames);
+
+  bool resuming = !resumeStage.empty();
+  for (const auto& stage : stages) {
+    if (cancelled()) return;
+    bool skipped = resuming && !replayedStages.count(stage.first);
+    beginStage(stage.first, skipped);
+    if (skipped) {
+      if (stage.first == "createCountryMap" && !restoreCheckpoint()) {
+        finishProgress(false);
+        return;
+      }
+      if (stage.first == resumeStage) resuming = false;
+      continue;
+    }
+    // displayStats failing is not fatal.
+    if (!(this->*stage.second)() && stage.first != "displayStats") {
+      finishProgress(false);
+      return;
+    }
+    if (stage.first == resumeStage) resuming = false;
+    if (!resuming && checkpointStages.count(stage.first)) {
+      writeCheckpoint(stage.first);
+    }
+  }
 
-  if (debug) (*debug) << "calculateDynasticScores" << std::endl;
+  if (cancelled()) return;
+  beginStage("calculateDynasticScores");
   calculateDynasticScores();
-  if (debug) (*debug) << "cleanUp" << std::endl;
+  if (cancelled()) return;
+  beginStage("cleanUp");
   cleanUp();
-  if (debug) (*debug) << "Done, writing" << std::endl;
+  idAllocator.flush(eu4Game);
+  beginStage("exportWorld");
+  exportWorld();
+  finishProgress(true);
 
   Logger::logStream(LogStream::Info) << "Done with conversion, writing to Output/converted.eu4.\n";
+  AllocationProfile::beginStage("writeConvertedSave");
   writeConvertedSave(final);
 }
 
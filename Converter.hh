@@ -1,12 +1,18 @@
 #ifndef CONVERTER_HH
 #define CONVERTER_HH
 
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QThread>
+#include <atomic>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <string>
 #include <queue>
+#include <set>
 #include <unordered_set>
+#include <vector>
 
 #include "UtilityFunctions.hh"
 
@@ -30,15 +36,40 @@ public:
   static ConverterJob const* const Statistics;
   static ConverterJob const* const DynastyScores;
   static ConverterJob const* const MergeSaves;
+  static ConverterJob const* const DiffSaves;
+  static ConverterJob const* const MemoryCensus;
+};
+
+// Snapshot of how far a job has come. Fractions and estimates are weighted
+// by how long each stage took in earlier runs, when known.
+struct ConverterProgress {
+  ConverterProgress ()
+    : stageIndex(0), numStages(0), itemsDone(0), itemsTotal(0),
+      fractionDone(0), secondsLeft(-1), running(false) {}
+
+  string job;
+  string stage;
+  int stageIndex;
+  int numStages;
+  int itemsDone;  // Within the current stage, if it reports items.
+  int itemsTotal;
+  double fractionDone;
+  double secondsLeft; // Negative if unknown.
+  bool running;
 };
 
 class Object;
 class Window;
+struct PrefetchState;
 class Converter : public QThread {
 public:
   Converter (Window* ow, string fname);
   ~Converter ();
   void scheduleJob (ConverterJob const* const cj) {jobsToDo.push(cj);}
+  // Safe to call from any thread.
+  ConverterProgress getProgress () const;
+  // Safe to call from any thread; the running job stops at its next check.
+  void cancelJob () {cancelRequested = true;}
 
 protected:
   void run ();
@@ -49,6 +80,18 @@ private:
   Object* ck2Game;
   Object* eu4Game;
   queue<ConverterJob const*> jobsToDo;
+  std::atomic<bool> cancelRequested;
+  bool jobCancelled; // The running job has seen cancelRequested.
+  bool ck2Modified; // Pruned, or changed by conversion stages.
+  unsigned long long ck2LoadedHash; // Only with verify_reset.
+  Object* checkpointRecord; // Links to restore when resuming, see loadCheckpoint.
+  map<string, string> stageFingerprints;
+
+  // Files parsed in the background, see prefetchFiles. loadTextFile takes
+  // them from here instead of parsing them again.
+  std::shared_ptr<PrefetchState> prefetch;
+  set<string> prefetchNames;
+  map<string, Object*> prefetchedFiles;
 
   // Conversion processes
   bool adjustBalkanisation ();
@@ -62,6 +105,7 @@ private:
   bool cultureAndReligion ();
   bool displayStats ();
   bool estates ();
+  void exportWorld ();
   bool hreAndPapacy ();
   bool modifyProvinces ();
   bool moveBuildings ();
@@ -76,14 +120,27 @@ private:
 
   // Infrastructure
   void loadFile ();
+  bool cancelled () {
+    if (cancelRequested) jobCancelled = true;
+    return jobCancelled;
+  }
   void checkProvinces ();
   void convert ();
   void debugParser ();
+  void diffSaves ();
   void dynastyScores ();
+  void memoryCensus ();
+  void reportAllocations ();
   void mergeSaves ();
   void playerWars ();
   void configure ();
   void dejures ();
+  void clearWrappers ();
+  void loadCK2Game ();
+  void restoreConfig ();
+  void restoreLoadedState ();
+  void resetAfterCancel ();
+  void verifyReset ();
   void statistics ();
 
   // Initialisers
@@ -92,8 +149,19 @@ private:
   bool createCountryMap ();
   bool createProvinceMap ();
   void loadFiles ();
+  void collectPrefetch ();
+  void prefetchFiles ();
+  bool pruneCK2Game ();
   void setDynastyNames (Object* dynastyNames);
 
+  // Progress reporting:
+  void startProgress (const string& job, const vector<string>& stages);
+  void beginStage (const string& stage, bool restored = false);
+  void setStageItems (int total);
+  void advanceStage (int items = 1);
+  void finishProgress (bool success);
+  void estimate (ConverterProgress& prog) const;
+
   // Helpers:
   void collectPrimaryTitles(std::vector<Object*>& players);
   string getConversionDate(int add_years);
@@ -103,7 +171,11 @@ private:
   Object* createMonarchId ();
   Object* createTypedId (string keyword, string idType);
   Object* createUnitId (string unitType);
-  Object* loadTextFile (string fname);
+  void fingerprintStages (const vector<string>& stages);
+  string loadCheckpoint (const vector<string>& stages);
+  bool restoreCheckpoint ();
+  void writeCheckpoint (const string& stage);
+  Object* loadTextFile (string fname, const ParseOptions& options = ParseOptions());
   bool hasDLC(const std::string& dlc);
   bool hasAnyDLC(const std::unordered_set<std::string>& dlcs);
   bool makeAdvisor(CK2Character* councillor, Object* country_advisors,
@@ -129,6 +201,7 @@ private:
   Object* ckBuildingObject;
   Object* ckBuildingWeights;
   Object* configObject;
+  Object* configLoaded; // configObject as read, see restoreConfig.
   Object* countryMapObject;
   Object* customObject;
   Object* deJureObject;
@@ -136,6 +209,18 @@ private:
   Object* provinceMapObject;
 
   Window* outputWindow;
+
+  // Progress state, guarded by progressMutex.
+  mutable QMutex progressMutex;
+  ConverterProgress progress;
+  vector<string> progressStages;
+  map<string, double> stageSeconds; // This run.
+  map<string, double> stageWeights; // Seconds per stage in earlier runs.
+  set<string> restoredStages;       // From a checkpoint, not run.
+  // Bumped per item without the mutex, and copied into snapshots.
+  std::atomic<int> stageItemsDone;
+  QElapsedTimer jobTimer;
+  QElapsedTimer stageTimer;
 };
 
 #endif
@@ -13,6 +13,7 @@ class CK2Title;
 class EU4Country : public Enumerable<EU4Country>, public ObjectWrapper {
 public:
   EU4Country (Object* o);
+  static void clear () {Enumerable<EU4Country>::clear();}
 
   void addProvince(EU4Province* prov);
   void remProvince (EU4Province* prov);
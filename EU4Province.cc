@@ -29,6 +29,11 @@ void EU4Province::assignCountry(EU4Country* eu4) {
   eu4Country->addProvince(this);
 }
 
+void EU4Province::restoreCountry (EU4Country* eu4) {
+  eu4Country = eu4;
+  eu4Country->addProvince(this);
+}
+
 void EU4Province::assignProvince (CK2Province* ck) {
   ckProvinces.push_back(ck);
 }
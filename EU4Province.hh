@@ -9,10 +9,13 @@ class EU4Country;
 class EU4Province : public Enumerable<EU4Province>, public ObjectWrapper {
 public:
   EU4Province (Object* o);
+  static void clear () {Enumerable<EU4Province>::clear();}
 
   void addCore (string countryTag);
   void assignCountry (EU4Country* eu4);
   void assignProvince (CK2Province* ck);
+  // Links the wrappers without touching the owner fields, for checkpoints.
+  void restoreCountry (EU4Country* eu4);
   bool converts () const;
   EU4Country* getEU4Country () const {return eu4Country;}
   bool hasBuilding(string buildingTag);
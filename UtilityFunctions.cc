@@ -1,8 +1,15 @@
 #include "UtilityFunctions.hh"
 #include <cctype>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstdio>
+#include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
 #include <stdarg.h>
 
 char strbuffer[10000]; 
@@ -12,6 +19,24 @@ const triplet triplet::zero(0, 0, 0);
 const string QuotedNone("\"none\"");
 const string PlainNone("none");
 
+namespace {
+// FNV-1a.
+unsigned long long hashString (const string& str, unsigned long long hash) {
+  for (unsigned int i = 0; i < str.size(); ++i) {
+    hash ^= (unsigned char) str[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// SplitMix64 finaliser.
+unsigned long long mix (unsigned long long z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+}  // namespace
+
 double degToRad (double degrees) {
   return degrees * 3.14159265 / 180; 
 }
@@ -404,9 +429,490 @@ string nameAndNumber(const ObjectWrapper* prov, string key, string def) {
 }
 
 string nameAndNumber(Object* prov, string key, string def) {
+  AllocationSite site("nameAndNumber");
   if (!prov) {
     return "null";
   }
   return prov->getKey() + " (" +
          remQuotes(prov->safeGetString(key, def)) + ")";
 }
+
+namespace {
+template <class Removed>
+void compactChildren (Object* parent, Removed removed) {
+  objvec children = parent->getLeaves();
+  objvec kept;
+  kept.reserve(children.size());
+  for (auto* child : children) {
+    if (!removed(child)) kept.push_back(child);
+  }
+  if (kept.size() == children.size()) return;
+  parent->setValue(kept);
+}
+}
+
+void removeChildren (Object* parent, const unordered_set<Object*>& targets) {
+  if (targets.empty()) return;
+  compactChildren(parent, [&targets] (Object* child) {return targets.count(child) > 0;});
+}
+
+void unsetValues (Object* parent, const unordered_set<string>& keys) {
+  if (keys.empty()) return;
+  compactChildren(parent, [&keys] (Object* child) {return keys.count(child->getKey()) > 0;});
+}
+
+namespace {
+std::mutex parserMutex;
+
+// Holds the parser lock and swaps in the options for its lifetime.
+class ScopedParseOptions {
+public:
+  ScopedParseOptions (const ParseOptions& options)
+    : lock(parserMutex)
+    , ignoreString(Parser::ignoreString)
+    , specialCases(Parser::specialCases)
+    , equalsSign(Parser::EqualsSign)
+    , topLevel(Parser::topLevel)
+  {
+    Parser::ignoreString = options.ignoreString;
+    Parser::specialCases = options.specialCases;
+    if (!options.equalsSign.empty()) Parser::EqualsSign = options.equalsSign;
+    if (options.topLevel) Parser::topLevel = options.topLevel;
+  }
+
+  ~ScopedParseOptions () {
+    Parser::ignoreString = ignoreString;
+    Parser::specialCases = specialCases;
+    Parser::EqualsSign = equalsSign;
+    Parser::topLevel = topLevel;
+  }
+
+private:
+  std::lock_guard<std::mutex> lock;
+  string ignoreString;
+  map<string, string> specialCases;
+  string equalsSign;
+  Object* topLevel;
+};
+}
+
+Object* parseFile (const string& fname, const ParseOptions& options) {
+  AllocationSite site("parseFile");
+  ScopedParseOptions scoped(options);
+  return processFile(fname);
+}
+
+void writeObject (ostream& out, Object* obj, const ParseOptions& options) {
+  AllocationSite site("writeObject");
+  ScopedParseOptions scoped(options);
+  out << (*obj);
+}
+
+namespace {
+const int kMaxProfileStages = 64;
+const int kMaxProfileSites = 64;
+const int kProfileNameLength = 64;
+const char* const kUnmarkedSite = "(unmarked)";
+
+struct SiteCounts {
+  std::atomic<const char*> site;
+  std::atomic<long long> allocations;
+  std::atomic<long long> bytes;
+};
+
+struct StageCounts {
+  char name[kProfileNameLength];
+  std::atomic<long long> allocations;
+  std::atomic<long long> bytes;
+  std::atomic<long long> frees;
+  std::atomic<long long> untracked;
+  SiteCounts sites[kMaxProfileSites];
+};
+
+// Fixed tables, so that counting from inside operator new never allocates.
+StageCounts profileStages[kMaxProfileStages];
+std::atomic<bool> profiling(false);
+std::atomic<int> currentStage(-1);
+std::atomic<int> numProfileStages(0);
+// Bumped by every start, so frees of blocks from an earlier profile are
+// not counted against this one.
+std::atomic<int> profileGeneration(0);
+thread_local const char* currentSite = 0;
+
+#ifdef ALLOCATION_PROFILE
+// Which stage allocated each counted block, so that its free is counted
+// against that stage. This is kept beside the blocks, not in front of
+// them, because the libstdc++ and Qt DLLs allocate with their own operator
+// new and their blocks may be freed through ours; a block not found here
+// is simply freed. Open addressing, where freed entries are left as
+// markers until start clears the table.
+const int kBlockTableBits = 22;
+const size_t kBlockTableSize = size_t(1) << kBlockTableBits;
+const int kBlockProbes = 32;
+const uintptr_t kEmptyEntry = 0;
+const uintptr_t kFreedEntry = 1;
+
+struct BlockEntry {
+  std::atomic<uintptr_t> block;
+  std::atomic<int> stage;
+  std::atomic<int> generation;
+};
+
+// Allocated by the first start, with calloc so as not to count itself.
+BlockEntry* blockTable = 0;
+
+size_t blockSlot (uintptr_t block) {
+  return (size_t) (((block >> 4) * 0x9E3779B97F4A7C15ULL) >>
+                   (64 - kBlockTableBits));
+}
+
+void recordBlock (void* ptr, int stage) {
+  uintptr_t block = reinterpret_cast<uintptr_t>(ptr);
+  size_t slot = blockSlot(block);
+  for (int i = 0; blockTable && i < kBlockProbes; ++i) {
+    BlockEntry& entry = blockTable[(slot + i) & (kBlockTableSize - 1)];
+    uintptr_t occupant = entry.block.load(std::memory_order_relaxed);
+    if (occupant != kEmptyEntry && occupant != kFreedEntry) continue;
+    if (!entry.block.compare_exchange_strong(occupant, block)) continue;
+    // No one looks the block up before it is handed out.
+    entry.stage.store(stage, std::memory_order_relaxed);
+    entry.generation.store(profileGeneration.load(std::memory_order_relaxed),
+                           std::memory_order_release);
+    return;
+  }
+  profileStages[stage].untracked.fetch_add(1, std::memory_order_relaxed);
+}
+
+void forgetBlock (void* ptr) {
+  if (!blockTable || !profiling.load(std::memory_order_relaxed)) return;
+  uintptr_t block = reinterpret_cast<uintptr_t>(ptr);
+  size_t slot = blockSlot(block);
+  for (int i = 0; i < kBlockProbes; ++i) {
+    BlockEntry& entry = blockTable[(slot + i) & (kBlockTableSize - 1)];
+    uintptr_t occupant = entry.block.load(std::memory_order_acquire);
+    if (occupant == kEmptyEntry) return;
+    if (occupant != block) continue;
+    int stage = entry.stage.load(std::memory_order_relaxed);
+    int generation = entry.generation.load(std::memory_order_acquire);
+    entry.block.store(kFreedEntry, std::memory_order_relaxed);
+    if (generation == profileGeneration.load(std::memory_order_relaxed)) {
+      profileStages[stage].frees.fetch_add(1, std::memory_order_relaxed);
+    }
+    return;
+  }
+}
+
+void clearBlockTable () {
+  if (!blockTable) {
+    blockTable = static_cast<BlockEntry*>(
+        calloc(kBlockTableSize, sizeof(BlockEntry)));
+    return;
+  }
+  for (size_t i = 0; i < kBlockTableSize; ++i) {
+    blockTable[i].block.store(kEmptyEntry, std::memory_order_relaxed);
+  }
+}
+
+int countAllocation (size_t size) {
+  if (!profiling.load(std::memory_order_relaxed)) return -1;
+  int index = currentStage.load(std::memory_order_relaxed);
+  if (index < 0) return -1;
+  StageCounts& stage = profileStages[index];
+  stage.allocations.fetch_add(1, std::memory_order_relaxed);
+  stage.bytes.fetch_add(size, std::memory_order_relaxed);
+
+  const char* site = currentSite ? currentSite : kUnmarkedSite;
+  for (auto& slot : stage.sites) {
+    const char* occupant = slot.site.load(std::memory_order_acquire);
+    if (!occupant) {
+      // Claim the slot; if another thread got there first, see whose it is.
+      occupant = 0;
+      if (slot.site.compare_exchange_strong(occupant, site)) occupant = site;
+    }
+    if (occupant != site) continue;
+    slot.allocations.fetch_add(1, std::memory_order_relaxed);
+    slot.bytes.fetch_add(size, std::memory_order_relaxed);
+    break;
+  }
+  return index;
+}
+
+// Calls the new_handler until it gives up, as the standard operator new
+// does. Returns null if it does.
+void* allocateBlock (size_t size) {
+  if (size == 0) size = 1;
+  void* block = 0;
+  while (!(block = malloc(size))) {
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) return 0;
+    handler();
+  }
+  int stage = countAllocation(size);
+  if (stage >= 0) recordBlock(block, stage);
+  return block;
+}
+
+void freeBlock (void* ptr) {
+  if (!ptr) return;
+  forgetBlock(ptr);
+  free(ptr);
+}
+#endif
+}
+
+#ifdef ALLOCATION_PROFILE
+// The over-aligned forms are left to the library, which pairs them with
+// its own aligned free; they are not counted.
+void* operator new (size_t size) {
+  void* ret = allocateBlock(size);
+  if (!ret) throw std::bad_alloc();
+  return ret;
+}
+
+void* operator new[] (size_t size) {
+  return operator new(size);
+}
+
+void* operator new (size_t size, const std::nothrow_t&) noexcept {
+  return allocateBlock(size);
+}
+
+void* operator new[] (size_t size, const std::nothrow_t&) noexcept {
+  return allocateBlock(size);
+}
+
+void operator delete (void* ptr) noexcept {freeBlock(ptr);}
+void operator delete[] (void* ptr) noexcept {freeBlock(ptr);}
+void operator delete (void* ptr, size_t) noexcept {freeBlock(ptr);}
+void operator delete[] (void* ptr, size_t) noexcept {freeBlock(ptr);}
+void operator delete (void* ptr, const std::nothrow_t&) noexcept {freeBlock(ptr);}
+void operator delete[] (void* ptr, const std::nothrow_t&) noexcept {freeBlock(ptr);}
+#endif
+
+bool AllocationProfile::available () {
+#ifdef ALLOCATION_PROFILE
+  return true;
+#else
+  return false;
+#endif
+}
+
+void AllocationProfile::start () {
+  profiling = false;
+  currentStage = -1;
+  ++profileGeneration;
+  for (auto& stage : profileStages) {
+    stage.name[0] = 0;
+    stage.allocations = 0;
+    stage.bytes = 0;
+    stage.frees = 0;
+    stage.untracked = 0;
+    for (auto& slot : stage.sites) {
+      slot.site = nullptr;
+      slot.allocations = 0;
+      slot.bytes = 0;
+    }
+  }
+  numProfileStages = 0;
+#ifdef ALLOCATION_PROFILE
+  clearBlockTable();
+#endif
+  profiling = true;
+}
+
+void AllocationProfile::stop () {
+  profiling = false;
+  currentStage = -1;
+}
+
+bool AllocationProfile::active () {
+  return profiling;
+}
+
+void AllocationProfile::beginStage (const string& name) {
+  if (!profiling) return;
+  int index = numProfileStages;
+  if (index >= kMaxProfileStages) {
+    currentStage = -1;
+    return;
+  }
+  // Copy before publishing the index; the copy does not allocate.
+  size_t length = name.copy(profileStages[index].name, kProfileNameLength - 1);
+  profileStages[index].name[length] = 0;
+  numProfileStages = index + 1;
+  currentStage = index;
+}
+
+vector<AllocationProfile::Stage> AllocationProfile::results () {
+  vector<Stage> ret;
+  int numStages = numProfileStages;
+  for (int i = 0; i < numStages; ++i) {
+    const StageCounts& counts = profileStages[i];
+    Stage stage;
+    stage.name = counts.name;
+    stage.allocations = counts.allocations;
+    stage.bytes = counts.bytes;
+    stage.frees = counts.frees;
+    stage.untracked = counts.untracked;
+    for (const auto& slot : counts.sites) {
+      const char* site = slot.site;
+      if (!site) break;
+      stage.sites.push_back({site, slot.allocations, slot.bytes});
+    }
+    sort(stage.sites.begin(), stage.sites.end(),
+         [](const Site& one, const Site& two) {return one.bytes > two.bytes;});
+    ret.push_back(stage);
+  }
+  return ret;
+}
+
+AllocationSite::AllocationSite (const char* name) : previous(currentSite) {
+  currentSite = name;
+}
+
+AllocationSite::~AllocationSite () {
+  currentSite = previous;
+}
+
+unsigned long long hashText (const string& str) {
+  return hashString(str, 14695981039346656037ULL);
+}
+
+unsigned long long hashFile (const string& fname) {
+  ifstream reader(fname.c_str(), ios::binary);
+  if (!reader.good()) return 0;
+  unsigned long long hash = 14695981039346656037ULL;
+  vector<char> buffer(1 << 20);
+  while (reader) {
+    reader.read(&buffer[0], buffer.size());
+    for (streamsize i = 0; i < reader.gcount(); ++i) {
+      hash ^= (unsigned char) buffer[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+unsigned long long combineHashes (unsigned long long hash, unsigned long long value) {
+  return mix(hash ^ mix(value));
+}
+
+unsigned long long TreeHashes::hashSubtree (Object* obj, HashMap& out) {
+  unsigned long long hash = hashString(obj->getKey(), 14695981039346656037ULL);
+  if (obj->isLeaf()) {
+    hash = hashString(obj->getLeaf(), mix(hash ^ 1));
+  } else {
+    for (int i = 0; i < obj->numTokens(); ++i) {
+      hash = hashString(obj->getToken(i), mix(hash ^ 2));
+    }
+    for (auto* child : obj->getLeaves()) {
+      hash = mix(hash ^ hashSubtree(child, out));
+    }
+  }
+  out[obj] = hash;
+  return hash;
+}
+
+void TreeHashes::compute (Object* root) {
+  hashes.clear();
+  objvec sections = root->getLeaves();
+  vector<HashMap> partials = parallelPartials<HashMap>(
+      sections.size(),
+      [&sections](HashMap& partial, int idx) {hashSubtree(sections[idx], partial);});
+  for (auto& partial : partials) {
+    hashes.insert(partial.begin(), partial.end());
+  }
+
+  unsigned long long hash = hashString(root->getKey(), 14695981039346656037ULL);
+  for (int i = 0; i < root->numTokens(); ++i) {
+    hash = hashString(root->getToken(i), mix(hash ^ 2));
+  }
+  for (auto* section : sections) {
+    hash = mix(hash ^ hashes[section]);
+  }
+  hashes[root] = hash;
+}
+
+unsigned long long TreeHashes::get (Object* obj) const {
+  auto hash = hashes.find(obj);
+  if (hash == hashes.end()) return 0;
+  return hash->second;
+}
+
+namespace {
+string describeValue (Object* obj) {
+  if (obj->isLeaf()) return obj->getLeaf();
+  if (obj->numTokens() == 0) return "{...}";
+  string ret = "{";
+  for (int i = 0; i < obj->numTokens() && i < 5; ++i) {
+    ret += " " + obj->getToken(i);
+  }
+  return ret + (obj->numTokens() > 5 ? " ... }" : " }");
+}
+
+bool isComposite (Object* obj) {
+  return !obj->isLeaf() && obj->numTokens() == 0;
+}
+}
+
+void diffTrees (Object* one, Object* two, const TreeHashes& oneHashes,
+                const TreeHashes& twoHashes, vector<string>& changes,
+                unsigned int maxChanges) {
+  // Paths are built on the way down; the root itself has none.
+  struct Pending {
+    Object* one;
+    Object* two;
+    string path;
+  };
+  vector<Pending> stack = {{one, two, ""}};
+  while (!stack.empty() && changes.size() < maxChanges) {
+    Pending current = stack.back();
+    stack.pop_back();
+    if (!current.one) {
+      changes.push_back("added " + current.path);
+      continue;
+    }
+    if (!current.two) {
+      changes.push_back("removed " + current.path);
+      continue;
+    }
+    if (oneHashes.get(current.one) == twoHashes.get(current.two)) continue;
+    if (!isComposite(current.one) || !isComposite(current.two)) {
+      changes.push_back("changed " + current.path + ": " +
+                        describeValue(current.one) + " -> " +
+                        describeValue(current.two));
+      continue;
+    }
+
+    vector<string> keyOrder;
+    map<string, pair<objvec, objvec> > byKey;
+    for (auto* child : current.one->getLeaves()) {
+      auto& children = byKey[child->getKey()];
+      if (children.first.empty()) keyOrder.push_back(child->getKey());
+      children.first.push_back(child);
+    }
+    for (auto* child : current.two->getLeaves()) {
+      auto& children = byKey[child->getKey()];
+      if (children.first.empty() && children.second.empty()) {
+        keyOrder.push_back(child->getKey());
+      }
+      children.second.push_back(child);
+    }
+
+    string prefix = current.path.empty() ? "" : current.path + "/";
+    vector<Pending> children;
+    for (const auto& key : keyOrder) {
+      const objvec& ones = byKey[key].first;
+      const objvec& twos = byKey[key].second;
+      unsigned int count = max(ones.size(), twos.size());
+      for (unsigned int i = 0; i < count; ++i) {
+        string path = prefix + key;
+        if (count > 1) path += "[" + to_string(i) + "]";
+        children.push_back({i < ones.size() ? ones[i] : nullptr,
+                            i < twos.size() ? twos[i] : nullptr, path});
+      }
+    }
+    // Reversed, so that differences come out in file order.
+    stack.insert(stack.end(), children.rbegin(), children.rend());
+  }
+}
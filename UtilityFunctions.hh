@@ -1,13 +1,16 @@
 #ifndef UTILITIES_HH
 #define UTILITIES_HH
 
+#include <algorithm>
 #include <climits>
 #include <cstdlib>
 #include <map>
 #include <cassert>
 #include <cmath> 
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "boost/foreach.hpp"
 #include "boost/tuple/tuple.hpp"
@@ -26,6 +29,33 @@ double radToDeg (double radians);
 
 bool yearMonthDay (const string& date, int& year, int& month, int& day);
 
+// Splits [0, count) into one contiguous chunk per hardware thread and calls
+// body(partial, i) for each index, with one partial result per chunk. The
+// partials come back in index order, so merging them front to back gives
+// the same result as a serial loop. Bodies must not touch shared state,
+// including the Logger.
+template <class T, class Body>
+vector<T> parallelPartials (int count, Body body) {
+  int numChunks = max(1, (int) thread::hardware_concurrency());
+  numChunks = min(numChunks, max(count, 1));
+  vector<T> partials(numChunks);
+  vector<thread> workers;
+  for (int chunk = 0; chunk < numChunks; ++chunk) {
+    int begin = (int) ((long long) count * chunk / numChunks);
+    int end = (int) ((long long) count * (chunk + 1) / numChunks);
+    workers.emplace_back([&partials, &body, chunk, begin, end] () {
+      for (int i = begin; i < end; ++i) body(partials[chunk], i);
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  return partials;
+}
+
+template <class Body>
+void parallelFor (int count, Body body) {
+  parallelPartials<char>(count, [&body] (char&, int i) {body(i);});
+}
+
 enum RollType {Equal = 0, GtEqual, LtEqual, Greater, Less};
 
 struct DieRoll {
@@ -377,4 +407,102 @@ string nameAndNumber(const ObjectWrapper* prov, string key = "name",
 string nameAndNumber(Object* prov, string key = "name",
                      string def = "\"could not find name\"");
 
+// Batch versions of Object::removeObject and Object::unsetValue. Each call
+// to those searches and erases from the child list; these rebuild the list
+// once, keeping the other children in order. As with removeObject, the
+// removed children are not deleted.
+void removeChildren (Object* parent, const unordered_set<Object*>& targets);
+void unsetValues (Object* parent, const unordered_set<string>& keys);
+
+// Settings for reading or writing one file. The Parser keeps these as
+// statics, so parseFile and writeObject apply them under a lock for the
+// duration of the call and restore the previous values afterwards; no
+// caller should set the Parser statics directly.
+struct ParseOptions {
+  ParseOptions () : topLevel(0) {}
+
+  string ignoreString;              // Header to skip, e.g. CK2txt.
+  map<string, string> specialCases; // Text replacements before parsing.
+  string equalsSign;                // Empty for the Parser's own default.
+  Object* topLevel;                 // Written without its own braces.
+};
+
+Object* parseFile (const string& fname, const ParseOptions& options = ParseOptions());
+void writeObject (ostream& out, Object* obj, const ParseOptions& options = ParseOptions());
+
+// Stable 64-bit hashes, the same on every run and platform, for
+// fingerprints that are written to disk and compared later. hashFile
+// hashes the file's bytes; a missing file hashes as zero.
+unsigned long long hashText (const string& str);
+unsigned long long hashFile (const string& fname);
+unsigned long long combineHashes (unsigned long long hash, unsigned long long value);
+
+// Content hashes of Object subtrees, kept beside the tree since Object
+// has no room for them. Computed bottom-up: a leaf hashes its key and
+// value, a list its key and tokens, anything else its key and its
+// children's hashes in order. Equal hashes mean equal subtrees.
+class TreeHashes {
+public:
+  // Hashes root and everything below it, the top-level sections in
+  // parallel. The tree must not change while this runs.
+  void compute (Object* root);
+  unsigned long long get (Object* obj) const; // Zero if never hashed.
+
+private:
+  typedef unordered_map<Object*, unsigned long long> HashMap;
+  static unsigned long long hashSubtree (Object* obj, HashMap& out);
+
+  HashMap hashes;
+};
+
+// Appends the paths at which two hashed trees differ, such as
+// "changed provinces/-1/owner: \"FRA\" -> \"ENG\"", stopping after
+// maxChanges. Only subtrees whose hashes differ are visited. Repeated
+// keys are matched by position, so an insertion shows up as a run of
+// changes.
+void diffTrees (Object* one, Object* two, const TreeHashes& oneHashes,
+                const TreeHashes& twoHashes, vector<string>& changes,
+                unsigned int maxChanges);
+
+// Opt-in allocation counting, for builds with ALLOCATION_PROFILE defined;
+// other builds keep the standard operator new and count nothing. While
+// active, every allocation is counted against the current stage and the
+// innermost AllocationSite open on the allocating thread, and every free
+// against the stage that allocated the block. Counting never allocates.
+// Over-aligned allocations go to the library's operator new uncounted.
+class AllocationProfile {
+public:
+  struct Site {
+    string name;
+    long long allocations;
+    long long bytes;
+  };
+  struct Stage {
+    string name;
+    long long allocations;
+    long long bytes;
+    long long frees; // Of this stage's allocations, by any later stage.
+    long long untracked; // Allocations whose frees cannot be followed.
+    vector<Site> sites; // Most bytes first.
+  };
+
+  static bool available (); // False unless built with ALLOCATION_PROFILE.
+  static void start ();  // Clears the counts and starts counting.
+  static void stop ();
+  static bool active ();
+  static void beginStage (const string& name);
+  static vector<Stage> results ();
+};
+
+// Marks a section of code for AllocationProfile; name must be a string
+// literal, as sites are told apart by address.
+class AllocationSite {
+public:
+  AllocationSite (const char* name);
+  ~AllocationSite ();
+
+private:
+  const char* previous;
+};
+
 #endif
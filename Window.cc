@@ -30,6 +30,9 @@ ofstream* errorLog = 0;
 
 namespace {
 
+const int kFlushIntervalMs = 100;
+const int kMaxScrollback = 20000;
+
 void closeDebugLog () {
   if (!debugFile) return;
   debugFile->flush();
@@ -110,6 +113,10 @@ int main (int argc, char** argv) {
   QAction* mergeSaves = actionMenu->addAction("Merge saves");
   QAction* playerWars = actionMenu->addAction("Player wars");
   QAction* statistics = actionMenu->addAction("Statistics");
+  QAction* diffSaves = actionMenu->addAction("Diff saves");
+  QAction* memoryCensus = actionMenu->addAction("Memory census");
+  actionMenu->addSeparator();
+  QAction* cancelJob = actionMenu->addAction("Cancel current job");
   QObject::connect(convert, SIGNAL(triggered()), parentWindow, SLOT(convert()));
   QObject::connect(debugParser, SIGNAL(triggered()), parentWindow, SLOT(debugParser()));
   QObject::connect(dynastyScore, SIGNAL(triggered()), parentWindow, SLOT(dynasticScore()));
@@ -118,11 +125,14 @@ int main (int argc, char** argv) {
   QObject::connect(playerWars, SIGNAL(triggered()), parentWindow, SLOT(playerWars()));
   QObject::connect(statistics, SIGNAL(triggered()), parentWindow, SLOT(statistics()));
   QObject::connect(dejures, SIGNAL(triggered()), parentWindow, SLOT(dejures()));
+  QObject::connect(diffSaves, SIGNAL(triggered()), parentWindow, SLOT(diffSaves()));
+  QObject::connect(memoryCensus, SIGNAL(triggered()), parentWindow, SLOT(memoryCensus()));
+  QObject::connect(cancelJob, SIGNAL(triggered()), parentWindow, SLOT(cancelJob()));
 
   parentWindow->textWindow = new QPlainTextEdit(parentWindow);
   parentWindow->textWindow->setFixedSize(3*scr.width()/5 - 10, scr.height()/2-40);
   // No need to take up unlimited amounts of memory.
-  parentWindow->textWindow->setMaximumBlockCount(100000);
+  parentWindow->textWindow->setMaximumBlockCount(kMaxScrollback);
   parentWindow->textWindow->move(5, 30);
   parentWindow->textWindow->show();
 
@@ -162,7 +172,11 @@ int main (int argc, char** argv) {
 Window::Window (QWidget* parent)
   : QMainWindow(parent)
   , worker(0)
-{}
+  , flushTimer(new QTimer(this))
+{
+  connect(flushTimer, SIGNAL(timeout()), this, SLOT(flushMessages()));
+  flushTimer->start(kFlushIntervalMs);
+}
 
 Window::~Window () {
   closeDebugLog();
@@ -170,7 +184,40 @@ Window::~Window () {
 }
 
 void Window::message (QString m) {
-  textWindow->appendPlainText(m);
+  pendingMessages.append(m);
+  // Lines beyond the scrollback would be discarded on append anyway.
+  if (pendingMessages.size() > kMaxScrollback) pendingMessages.removeFirst();
+}
+
+// Appending one line at a time re-lays out the text window per line, which
+// freezes the GUI for verbose streams; the file log has every line anyway.
+void Window::flushMessages () {
+  showProgress();
+  if (pendingMessages.isEmpty()) return;
+  textWindow->appendPlainText(pendingMessages.join("\n"));
+  pendingMessages.clear();
+}
+
+void Window::showProgress () {
+  QString title = QApplication::translate("toplevel", "CK2 to EU4 converter");
+  if (worker) {
+    ConverterProgress progress = worker->getProgress();
+    if (progress.running) {
+      title += QString(" - %1 (%2/%3)")
+                   .arg(QString::fromStdString(progress.stage))
+                   .arg(progress.stageIndex + 1)
+                   .arg(progress.numStages);
+      if (progress.itemsTotal > 0) {
+        title += QString(" %1/%2").arg(progress.itemsDone).arg(progress.itemsTotal);
+      }
+      title += QString(", %1%").arg((int) (100 * progress.fractionDone));
+      if (progress.secondsLeft >= 0) {
+        title += QString(", about %1 min left")
+                     .arg((int) (progress.secondsLeft / 60) + 1);
+      }
+    }
+  }
+  if (title != windowTitle()) setWindowTitle(title);
 }
 
 void Window::loadFile () {
@@ -186,6 +233,12 @@ void Window::loadFile (string fname) {
   worker->scheduleJob(ConverterJob::LoadFile);
 }
 
+void Window::cancelJob () {
+  if (!worker) return;
+  Logger::logStream(LogStream::Info) << "Cancelling current job.\n";
+  worker->cancelJob();
+}
+
 void Window::convert () {
   if (!worker) {
     Logger::logStream(LogStream::Info) << "No file loaded.\n";
@@ -258,4 +311,20 @@ void Window::statistics () {
   worker->scheduleJob(ConverterJob::Statistics);
 }
 
+void Window::diffSaves () {
+  // Needs no CK save, so a fresh worker will do.
+  bool fresh = !worker;
+  if (fresh) worker = new Converter(this, "");
+  Logger::logStream(LogStream::Info) << "Queued up save diff.\n";
+  worker->scheduleJob(ConverterJob::DiffSaves);
+  if (fresh) worker->start();
+}
 
+void Window::memoryCensus () {
+  if (!worker) {
+    Logger::logStream(LogStream::Info) << "No file loaded.\n";
+    return;
+  }
+  Logger::logStream(LogStream::Info) << "Queued up memory census.\n";
+  worker->scheduleJob(ConverterJob::MemoryCensus);
+}
@@ -5,6 +5,8 @@
 #include <QMainWindow>
 #include <QObject>
 #include <QPlainTextEdit>
+#include <QStringList>
+#include <QTimer>
 #include "Object.hh"
 #include <map>
 #include <fstream>
@@ -24,17 +26,27 @@ public:
 
 public slots:
   void loadFile ();
+  void cancelJob ();
   void checkProvinces ();
   void convert ();
   void debugParser ();
   void dejures ();
+  void diffSaves ();
   void dynasticScore ();
+  void memoryCensus ();
   void mergeSaves ();
   void playerWars ();
   void statistics ();
   void message (QString m);
+  void flushMessages ();
 
 private:
+  // Log lines are appended in batches, see flushMessages.
+  QStringList pendingMessages;
+  QTimer* flushTimer;
+
+  // Shows the worker's current stage and estimate in the title bar.
+  void showProgress ();
 };
 
 #endif
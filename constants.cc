@@ -15,3 +15,22 @@ std::string femaleString;
 std::string governmentString;
 std::string deadCharHoldingsString;
 std::string traitString;
+
+const ChangedKeyword kCharacterKeywords[] = {
+    {kOldDemesne, kNewDemesne, &demesneString},
+    {kOldBirthName, kNewBirthName, &birthNameString},
+    {kOldBirthDate, kNewBirthDate, &birthDateString},
+    {kOldDynasty, kNewDynasty, &dynastyString},
+    {kOldAttributes, kNewAttributes, &attributesString},
+    {kOldPrestige, kNewPrestige, &prestigeString},
+    {kOldJobTitle, kNewJobTitle, &jobTitleString},
+    {kOldEmployer, kNewEmployer, &employerString},
+    {kOldFather, kNewFather, &fatherString},
+    {kOldMother, kNewMother, &motherString},
+    {kOldFemale, kNewFemale, &femaleString},
+    {kOldGovernment, kNewGovernment, &governmentString},
+    {kOldDeadCharHoldings, kNewDeadCharHoldings, &deadCharHoldingsString},
+    {kOldTraits, kNewTraits, &traitString},
+};
+const int kNumCharacterKeywords =
+    sizeof(kCharacterKeywords) / sizeof(kCharacterKeywords[0]);
@@ -66,4 +66,17 @@ const std::string kOldTraits = "traits";
 const std::string kNewTraits = "tr";
 extern std::string traitString;
 
+// A keyword that differs between save versions, and the variable that
+// holds whichever spelling the loaded save uses.
+struct ChangedKeyword {
+  const std::string& oldKey;
+  const std::string& newKey;
+  std::string* target;
+};
+
+// Keywords detected from the character list, all in a single pass; a new
+// version-specific key needs only a line here.
+extern const ChangedKeyword kCharacterKeywords[];
+extern const int kNumCharacterKeywords;
+
 #endif